@@ -1,22 +1,44 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a set of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Buffers are found through a hash table on (dev, blockno).
+// Each bucket has its own lock, which protects the chain and
+// the refcnt of the buffers on it, so lookups of different
+// blocks do not contend.  A buffer is recycled only on a miss,
+// under bcache.lock, by a clock sweep over all buffers: a
+// buffer released since the hand last passed it gets a second
+// chance.  Lock order is bcache.lock, then one bucket lock.
+//
+// Buffers come from kalloc() through a slab cache.  There are
+// always at least NBUF of them; past that, the cache grows on
+// a miss while there is free memory to spare, and bshrink()
+// gives idle buffers back when memory runs low.  If every
+// buffer is in use and no more can be allocated, bget() waits
+// for a brelse().
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
+// * To get one for a block you will overwrite, call bclaim.
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
+// * To write several buffers at once, call bwritestart on
+//     each, then bwait on each before releasing it.
+// * To have a block read into the cache while doing
+//     something else, call breadahead.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 //
-// The implementation uses two state flags internally:
+// The implementation uses three state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_ASYNC: breadahead started a read; bdone releases
+//     the buffer when it finishes.
 
 #include "types.h"
 #include "defs.h"
@@ -25,34 +47,155 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "slab.h"
 
-struct {
+#define NBUCKET 31
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;       // Chain through hnext
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;   // Serializes recycling, protects the ring
+  struct objcache cache;  // struct buf allocator
+  struct buf *hand;       // Clock hand, on the ring of all buffers
+  uint n;                 // Buffers allocated
+  uint max;               // Most buffers to allocate
+  uint reserve;           // Free pages to leave alone
+  int nwait;              // Processes in bget() waiting for a buffer
+  // Statistics, for bcachedump().
+  uint peak;              // Most buffers allocated at once
+  uint nsleep;            // Times bget() slept for a buffer
+  uint nfreed;            // Buffers bshrink() has given back
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev*7 + blockno) % NBUCKET];
+}
+
+// Return the buffer for dev, blockno on bucket k, with its
+// refcnt raised, or 0.  Caller must hold k->lock.
+static struct buf*
+bfind(struct bucket *k, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = k->head; b; b = b->hnext){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      return b;
+    }
+  }
+  return 0;
+}
+
+// Take b off the chain of bucket k.  Caller must hold k->lock.
+static void
+bunhash(struct bucket *k, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &k->head; *pp != b; pp = &(*pp)->hnext)
+    ;
+  *pp = b->hnext;
+}
+
+// Allocate a buffer and put it on the ring, behind the hand,
+// if the cache may grow.  Returns 0 otherwise.
+// Caller must hold bcache.lock.
+static struct buf*
+bnew(void)
+{
+  struct buf *b;
+
+  if(bcache.n >= NBUF &&
+     (bcache.n >= bcache.max || kfreecount() <= bcache.reserve))
+    return 0;
+  if((b = objalloc(&bcache.cache)) == 0)
+    return 0;
+  memset(b, 0, sizeof(*b));
+  initsleeplock(&b->lock, "buffer");
+  if(bcache.hand == 0){
+    b->prev = b->next = b;
+    bcache.hand = b;
+  } else {
+    b->next = bcache.hand;
+    b->prev = bcache.hand->prev;
+    b->prev->next = b;
+    bcache.hand->prev = b;
+  }
+  bcache.n++;
+  if(bcache.n > bcache.peak)
+    bcache.peak = bcache.n;
+  return b;
+}
+
+// Find an unused buffer with the clock and take it off its
+// chain.  Returns 0 if there is none.
+// Even if refcnt==0, B_DIRTY indicates a buffer is in use
+// because log.c has modified it but not yet committed it.
+// Caller must hold bcache.lock.
+static struct buf*
+bvictim(void)
+{
+  struct buf *b;
+  struct bucket *k;
+  uint n;
+
+  // Two turns of the clock clear every second chance.
+  for(n = 0; n < 2*bcache.n; n++){
+    b = bcache.hand;
+    bcache.hand = b->next;
+    k = bhash(b->dev, b->blockno);
+    acquire(&k->lock);
+    if(b->refcnt != 0 || (b->flags & B_DIRTY)){
+      release(&k->lock);
+      continue;
+    }
+    if(b->used){
+      b->used = 0;
+      release(&k->lock);
+      continue;
+    }
+    bunhash(k, b);
+    release(&k->lock);
+    return b;
+  }
+  return 0;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *k;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  for(k = bcache.bucket; k < bcache.bucket+NBUCKET; k++)
+    initlock(&k->lock, "bcache.bucket");
+  objcacheinit(&bcache.cache, "buf", sizeof(struct buf));
+  bcache.max = kfreecount() / 4;
+  bcache.reserve = kfreecount() / 8;
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // Put every buffer on a chain, as a block no one will ask
+  // for, so that recycling always finds it on one.
+  acquire(&bcache.lock);
+  for(i = 0; i < NBUF; i++){
+    if((b = bnew()) == 0)
+      panic("binit");
+    b->dev = -1;
+    b->blockno = i;
+    k = bhash(b->dev, b->blockno);
+    b->hnext = k->head;
+    k->head = b;
   }
+  release(&bcache.lock);
 }
 
 // Look through buffer cache for block on device dev.
@@ -62,34 +205,54 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
-
-  acquire(&bcache.lock);
+  struct bucket *k;
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  k = bhash(dev, blockno);
+  acquire(&k->lock);
+  b = bfind(k, dev, blockno);
+  release(&k->lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
+  acquire(&bcache.lock);
+  for(;;){
+    // Not cached.  Another process may have been getting a
+    // buffer for the same block, so look again once no one is.
+    acquire(&k->lock);
+    b = bfind(k, dev, blockno);
+    release(&k->lock);
+    if(b){
       release(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
     }
+
+    // Count ourselves as waiting before looking, so that
+    // a brelse() that comes after the look wakes us up.
+    bcache.nwait++;
+    if((b = bnew()) != 0 || (b = bvictim()) != 0)
+      break;
+    bcache.nsleep++;
+    sleep(&bcache, &bcache.lock);
+    bcache.nwait--;
   }
-  panic("bget: no buffers");
+  bcache.nwait--;
+
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->used = 0;
+  b->refcnt = 1;
+  acquire(&k->lock);
+  b->hnext = k->head;
+  k->head = b;
+  release(&k->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -100,23 +263,92 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if((b->flags & B_VALID) == 0) {
-    iderw(b);
+    iorw(b);
   }
   return b;
 }
 
+// Return a locked buf for the indicated block, which the
+// caller will overwrite completely, without reading it.
+struct buf*
+bclaim(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Start reading the indicated block into the cache, if it is
+// not there, without waiting for it.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  b->flags |= B_ASYNC;
+  iosubmit(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
+{
+  bwritestart(b);
+  bwait(b);
+}
+
+// Start writing b's contents to disk, and return.  Call
+// bwait() before changing or releasing b.  Must be locked.
+void
+bwritestart(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
   b->flags |= B_DIRTY;
-  iderw(b);
+  iosubmit(b);
+}
+
+// Wait for a write started by bwritestart().
+void
+bwait(struct buf *b)
+{
+  iowait(b);
+}
+
+// Drop a reference to b, whose sleep-lock is released.
+static void
+bput(struct buf *b)
+{
+  struct bucket *k;
+  int idle;
+
+  k = bhash(b->dev, b->blockno);
+  acquire(&k->lock);
+  b->refcnt--;
+  idle = b->refcnt == 0;
+  if (idle) {
+    // no one is waiting for it.
+    b->used = 1;
+  }
+  release(&k->lock);
+
+  // Someone in bget() may be waiting for any idle buffer.
+  if(idle && bcache.nwait > 0){
+    acquire(&bcache.lock);
+    wakeup(&bcache);
+    release(&bcache.lock);
+  }
 }
 
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Mark it recently used, for the clock.
 void
 brelse(struct buf *b)
 {
@@ -124,20 +356,66 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
+
+// Release a buffer whose read breadahead() started, now that
+// it has finished, on behalf of the process that started it.
+// Called from the disk interrupt.
+void
+bdone(struct buf *b)
+{
+  releasesleep(&b->lock);
+  bput(b);
+}
+
+// Free buffers that no one is using, keeping NBUF, until n
+// pages have gone back to kalloc() or there are no more.
+// Returns the number of pages freed.
+// Buffers are allocated and freed only under bcache.lock, so
+// it also keeps bcache.cache.nslab still.
+int
+bshrink(int n)
+{
+  struct buf *b;
+  struct bucket *k;
+  uint steps, nslab;
 
   acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
+  nslab = bcache.cache.nslab;
+  for(steps = bcache.n; steps > 0 && nslab - bcache.cache.nslab < n &&
+      bcache.n > NBUF; steps--){
+    b = bcache.hand;
+    bcache.hand = b->next;
+    k = bhash(b->dev, b->blockno);
+    acquire(&k->lock);
+    if(b->refcnt != 0 || (b->flags & B_DIRTY)){
+      release(&k->lock);
+      continue;
+    }
+    bunhash(k, b);
+    release(&k->lock);
     b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->next->prev = b->prev;
+    bcache.n--;
+    bcache.nfreed++;
+    // Put it back in its slab at once, rather than in this
+    // CPU's magazine, so that an emptied slab is freed.
+    objfree(&bcache.cache, b);
+    objreap(&bcache.cache);
   }
-  
+  n = nslab - bcache.cache.nslab;
   release(&bcache.lock);
+  return n;
+}
+
+void
+bcachedump(void)
+{
+  cprintf("bcache: %d buffers, max %d, peak %d\n", bcache.n, bcache.max,
+          bcache.peak);
+  cprintf("bcache: %d waits for a buffer, %d buffers given back\n",
+          bcache.nsleep, bcache.nfreed);
 }
 //PAGEBREAK!
 // Blank page.
@@ -4,11 +4,17 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  int used;         // released since the clock hand passed
+  struct buf *hnext; // hash chain
+  struct buf *prev; // ring of all buffers, for the clock
   struct buf *next;
   struct buf *qnext; // disk queue
+  uint qtime;       // ticks when queued, for deadlines
+  uint64 qtsc;      // rdtsc() when queued, for latency
+  int qpolicy;      // policy when queued, for latency
   uchar data[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // release buffer when the read finishes
 
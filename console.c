@@ -229,6 +229,10 @@ consoleintr(int (*getc)(void))
   release(&cons.lock);
   if(doprocdump) {
     procdump();  // now call procdump() wo. cons.lock held
+    kallocdump();
+    pcachedump();
+    bcachedump();
+    iodump();
   }
 }
 
@@ -0,0 +1,75 @@
+// Context switch microbenchmark.
+// Two processes pass a byte back and forth through a pair of
+// pipes, so each round trip costs two process switches.
+// Time is measured with the cycle counter, since a run takes
+// only a few timer ticks.  The two processes must share a CPU
+// for this to measure switches, so boot with CPUS=1 (the
+// default); with more CPUs they can run side by side and the
+// result is the cost of a cross-CPU wakeup instead.
+// Usage: ctxbench [round trips]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+#define N  20000
+
+int
+main(int argc, char *argv[])
+{
+  int n, i, pid, shift;
+  int ping[2], pong[2];
+  uint64 start, cycles;
+  char c;
+
+  n = N;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    printf(2, "usage: ctxbench [round trips]\n");
+    exit();
+  }
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf(2, "ctxbench: pipe failed\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(2, "ctxbench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &c, 1) == 1)
+      write(pong[1], &c, 1);
+    exit();
+  }
+  close(ping[0]);
+  close(pong[1]);
+
+  c = 'x';
+  start = rdtsc();
+  for(i = 0; i < n; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      printf(2, "ctxbench: pipe i/o failed\n");
+      break;
+    }
+  }
+  cycles = rdtsc() - start;
+  close(ping[1]);
+  close(pong[0]);
+  wait();
+
+  // Scale cycles down to 32 bits, so that the division
+  // needs no 64-bit library routine.
+  for(shift = 0; cycles >> 32; shift++)
+    cycles >>= 1;
+  printf(1, "ctxbench: %d round trips", i);
+  if(i > 0)
+    printf(1, ", %d cycles per switch", ((uint)cycles / (2 * i)) << shift);
+  printf(1, "\n");
+  exit();
+}
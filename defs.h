@@ -2,19 +2,31 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct ioqueue;
+struct pcidev;
 struct pipe;
 struct proc;
 struct rtcdate;
 struct spinlock;
+struct objcache;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct timer;
+struct vma;
 
 // bio.c
+void            bcachedump(void);
+struct buf*     bclaim(uint, uint);
+void            bdone(struct buf*);
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadahead(uint, uint);
 void            brelse(struct buf*);
+int             bshrink(int);
+void            bwait(struct buf*);
 void            bwrite(struct buf*);
+void            bwritestart(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -35,6 +47,8 @@ int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
 
 // fs.c
+uint            bmap(struct inode*, uint);
+void            icacheinit(void);
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
@@ -43,6 +57,7 @@ struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+void            ireadahead(struct inode*, uint, uint);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -56,29 +71,50 @@ int             writei(struct inode*, char*, uint, uint);
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
-void            iderw(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
 
+// iosched.c
+void            ioattach(uint, struct ioqueue*);
+void            iodone(struct ioqueue*, struct buf*);
+void            iodump(void);
+void            ioqinit(struct ioqueue*, char*, int, int, void(*)(struct buf*));
+void            iorw(struct buf*);
+int             iosetpolicy(char*);
+void            iostart(struct ioqueue*);
+void            iosubmit(struct buf*);
+void            iowait(struct buf*);
+
 // kalloc.c
 char*           kalloc(void);
+void            kallocdump(void);
+char*           kallocpages(int);
+int             kfreecount(void);
 void            kfree(char*);
+void            kfreepages(char*, int);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kref(char*);
+int             krefcnt(char*);
+extern uint     phystop;
 
 // kbd.c
 void            kbdintr(void);
 
 // lapic.c
+uint            cmos_read(uint);
 void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(int, int);
 void            lapicstartap(uchar, uint);
+void            lapicstarttimer(void);
+void            lapicstoptimer(void);
 void            microdelay(int);
 
 // log.c
@@ -95,9 +131,26 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pcache.c
+void            pcacheinit(void);
+void            pcacheinval(struct inode*);
+void            pcachedump(void);
+int             pcachehas(struct inode*, uint);
+char*           pcachemap(struct inode*, uint, uint);
+void            pcacheread(struct inode*, char*, uint, uint);
+int             pcacheshrink(int);
+void            pcachewrite(struct inode*, char*, uint, uint);
+
+// pci.c
+void            pcienable(struct pcidev*);
+int             pcifind(int, int, int, int, struct pcidev*);
+uint            pciread(struct pcidev*, uint);
+void            pciwrite(struct pcidev*, uint, uint);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
+void            pipeinit(void);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
@@ -106,6 +159,7 @@ int             pipewrite(struct pipe*, char*, int);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             getpriority(int);
 int             growproc(int);
 int             kill(int);
 struct cpu*     mycpu(void);
@@ -114,6 +168,7 @@ void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+int             setpriority(int, int);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
@@ -133,6 +188,12 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// slab.c
+void*           objalloc(struct objcache*);
+void            objcacheinit(struct objcache*, char*, uint);
+void            objfree(struct objcache*, void*);
+void            objreap(struct objcache*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -151,13 +212,16 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
 void            syscall(void);
 
 // timer.c
-void            timerinit(void);
+void            timeradd(struct timer*, uint);
+void            timerdel(struct timer*);
+void            timerexpire(void);
 
 // trap.c
 void            idtinit(void);
@@ -170,9 +234,15 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// virtio.c
+extern int      virtioirq;
+void            virtioinit(void);
+void            virtiointr(void);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
+void            kvmenable(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
@@ -180,11 +250,19 @@ int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*, uint, struct vma*);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             pagefault(struct proc*, uint, uint);
+void            dupvmas(struct vma*, struct vma*);
+void            freevmas(struct vma*);
+int             uvmtouch(struct proc*, uint, uint, int);
+int             uvmvalid(struct proc*, uint, uint);
+int             vmamap(struct proc*, uint, uint, int, struct inode*, uint, uint);
+int             vmaoverlap(struct proc*, uint, uint);
+int             vmaunmap(struct proc*, uint, uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -16,9 +16,11 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vma[NVMA], *v;
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
+  memset(vma, 0, sizeof(vma));
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -38,8 +40,11 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record where each segment comes from in the file; the
+  // pages are read in by pagefault() as the program touches
+  // them, so untouched code and data are never read.
   sz = 0;
+  v = vma;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -49,12 +54,23 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz >= KERNBASE)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.memsz == 0)
+      continue;
+    if(v == &vma[NVMA])
       goto bad;
+    v->start = ph.vaddr;
+    v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+    v->ip = idup(ip);
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    v->flags = VMA_WRITE;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
+    v++;
   }
   iunlockput(ip);
   end_op();
@@ -94,6 +110,11 @@ exec(char *path, char **argv)
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
   // Commit to the user image.
+  vmaunmap(curproc, 0, KERNBASE);
+  begin_op();
+  freevmas(curproc->vma);
+  end_op();
+  memmove(curproc->vma, vma, sizeof(vma));
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
@@ -108,6 +129,11 @@ exec(char *path, char **argv)
     freevm(pgdir);
   if(ip){
     iunlockput(ip);
+    freevmas(vma);
+    end_op();
+  } else {
+    begin_op();
+    freevmas(vma);
     end_op();
   }
   return -1;
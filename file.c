@@ -9,17 +9,25 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
+
+#define RAMIN 4   // First readahead window, in blocks
+#define RAMAX 64  // Largest readahead window
 
 struct devsw devsw[NDEV];
+// Open files come from an object cache, so there is no fixed
+// limit on how many the system has open; ftable.lock protects
+// their reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct objcache cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  objcacheinit(&ftable.cache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -28,16 +36,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = objalloc(&ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -66,9 +69,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  objfree(&ftable.cache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -92,10 +94,41 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// f has just read from off up to f->off.  If the read started
+// where the last one ended, it was sequential: open the
+// readahead window, or double it up to RAMAX, and start
+// reading the file that far past f->off into the buffer
+// cache.  Any other read closes the window.
+// Caller must hold f->ip->lock.
+static void
+readahead(struct file *f, uint off)
+{
+  uint end;
+
+  if(off != f->ranext){
+    f->ranext = f->rahead = f->off;
+    f->rawin = 0;
+    return;
+  }
+  f->ranext = f->off;
+  if(f->rawin == 0)
+    f->rawin = RAMIN;
+  else if(f->rawin < RAMAX)
+    f->rawin *= 2;
+  if(f->rahead < f->off)
+    f->rahead = f->off;
+  end = f->off + f->rawin*BSIZE;
+  if(f->rahead < end){
+    ireadahead(f->ip, f->rahead, end - f->rahead);
+    f->rahead = end;
+  }
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
 {
+  uint off;
   int r;
 
   if(f->readable == 0)
@@ -104,8 +137,11 @@ fileread(struct file *f, char *addr, int n)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    off = f->off;
+    if((r = readi(f->ip, addr, f->off, n)) > 0){
       f->off += r;
+      readahead(f, off);
+    }
     iunlock(f->ip);
     return r;
   }
@@ -6,6 +6,9 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint ranext;  // where a sequential read would start
+  uint rawin;   // readahead window in blocks; 0 if not sequential
+  uint rahead;  // read ahead up to here
 };
 
 
@@ -23,6 +26,8 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+
+  struct inode *next; // icache list; protected by icache.lock
 };
 
 // table mapping major device number to
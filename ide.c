@@ -1,4 +1,13 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.
+//
+// If the IDE controller is a PCI bus-master controller (such
+// as the PIIX in QEMU and Bochs), the disk moves the data
+// itself: idestart() points the controller at a physical
+// region descriptor (PRD) table naming the data of each buffer
+// in the request and issues a DMA command, and ideintr() only
+// stops the engine.  A request can then be up to NPRD adjacent
+// blocks.  Otherwise the driver falls back to programmed I/O,
+// copying one block at a time through the data port.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +21,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
+#include "iosched.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,15 +34,38 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
-
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
-
-static struct spinlock idelock;
-static struct buf *idequeue;
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+
+// Bus-master registers for the primary channel, at bmbase.
+#define BM_CMD        0
+#define BM_CMD_START  0x01   // Start the transfer
+#define BM_CMD_READ   0x08   // Disk to memory
+#define BM_STATUS     2
+#define BM_STATUS_ERR 0x02   // Write 1 to clear
+#define BM_STATUS_INT 0x04   // Write 1 to clear
+#define BM_PRDT       4      // Physical address of the PRD table
+
+// Physical region descriptor: one contiguous piece of memory
+// for a DMA transfer.  The table must not cross a 64KB boundary.
+struct prd {
+  uint addr;             // Physical address
+  ushort len;            // Byte count; 0 means 64KB
+  ushort flags;
+};
+#define PRD_EOT       0x8000 // Last entry in the table
+#define NPRD          16     // Most blocks in one DMA request
+
+// The I/O scheduler queues requests in ideq and starts them
+// one at a time.  idebuf is the one the disk is working on.
+// ideq.lock protects both.
+
+static struct ioqueue ideq;
+static struct buf *idebuf;
 
 static int havedisk1;
+static ushort bmbase;    // Bus-master I/O base, or 0 to use PIO
+static struct prd prdt[NPRD] __attribute__((aligned(NPRD*8)));
 static void idestart(struct buf*);
 
 // Wait for IDE disk to become ready.
@@ -47,12 +81,33 @@ idewait(int checkerr)
   return 0;
 }
 
+// Look for a PCI IDE controller that can do bus-master DMA
+// on the primary channel, and set bmbase if there is one.
+static void
+idedmainit(void)
+{
+  struct pcidev d;
+
+  if(!pcifind(PCI_ANY, PCI_ANY, PCI_CLASS_STORAGE, PCI_SUB_IDE, &d))
+    return;
+  // Programming interface bit 7: bus mastering supported.
+  // BAR4 holds the bus-master registers, in I/O space.
+  if(((pciread(&d, PCI_CLASS) >> 8) & 0x80) == 0)
+    return;
+  if((pciread(&d, PCI_BAR0 + 4*4) & PCI_BAR_IO) == 0 || d.bar[4] == 0)
+    return;
+  pcienable(&d);
+  bmbase = d.bar[4];
+  outb(bmbase + BM_CMD, 0);
+  outb(bmbase + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INT);
+  cprintf("ide: bus-master dma at 0x%x\n", bmbase);
+}
+
 void
 ideinit(void)
 {
   int i;
 
-  initlock(&idelock, "ide");
   ioapicenable(IRQ_IDE, ncpu - 1);
   idewait(0);
 
@@ -67,31 +122,65 @@ ideinit(void)
 
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  idedmainit();
+  ioqinit(&ideq, "ide", 1, bmbase ? NPRD : 1, idestart);
+  ioattach(0, &ideq);
+  if(havedisk1)
+    ioattach(1, &ideq);
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b and the buffers chained to it
+// through qnext.  Caller must hold ideq.lock.
 static void
 idestart(struct buf *b)
 {
-  if(b == 0)
+  struct buf *nb;
+  int n;
+
+  if(b == 0 || idebuf != 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  for(n = 0, nb = b; nb; nb = nb->qnext)
+    n++;
+  if(b->blockno + n > FSSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
+  if(n > (bmbase ? NPRD : 1))
+    panic("idestart: request too big");
+  if(bmbase){
+    read_cmd = IDE_CMD_RDDMA;
+    write_cmd = IDE_CMD_WRDMA;
+    // Each buffer's data lies within one page, so it is
+    // physically contiguous and cannot cross a 64KB boundary.
+    for(n = 0, nb = b; nb; n++, nb = nb->qnext){
+      prdt[n].addr = V2P(nb->data);
+      prdt[n].len = BSIZE;
+      prdt[n].flags = nb->qnext ? 0 : PRD_EOT;
+    }
+    outb(bmbase + BM_CMD, 0);
+    outl(bmbase + BM_PRDT, V2P(prdt));
+    outb(bmbase + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INT);
+  }
+
   if (sector_per_block > 7) panic("idestart");
 
+  idebuf = b;
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, n * sector_per_block);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(bmbase){
+    outb(0x1f7, (b->flags & B_DIRTY) ? write_cmd : read_cmd);
+    outb(bmbase + BM_CMD, BM_CMD_START |
+         ((b->flags & B_DIRTY) ? 0 : BM_CMD_READ));
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
     outsl(0x1f0, b->data, BSIZE/4);
   } else {
@@ -105,64 +194,30 @@ ideintr(void)
 {
   struct buf *b;
 
-  // First queued buffer is the active request.
-  acquire(&idelock);
+  acquire(&ideq.lock);
 
-  if((b = idequeue) == 0){
-    release(&idelock);
+  if((b = idebuf) == 0){
+    release(&ideq.lock);
     return;
   }
-  idequeue = b->qnext;
-
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+  idebuf = 0;
+
+  if(bmbase){
+    // The data is already in place; stop the engine and
+    // acknowledge the controller and the drive.
+    outb(bmbase + BM_CMD, 0);
+    outb(bmbase + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INT);
+    idewait(1);
+  } else if(!(b->flags & B_DIRTY) && idewait(1) >= 0){
+    // Read data if needed.
     insl(0x1f0, b->data, BSIZE/4);
+  }
 
   // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  iodone(&ideq, b);
 
   // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
-
-  release(&idelock);
-}
-
-//PAGEBREAK!
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
-{
-  struct buf **pp;
-
-  if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
-
-  acquire(&idelock);  //DOC:acquire-lock
-
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
-
-  // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
-
-  // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
-  }
-
+  iostart(&ideq);
 
-  release(&idelock);
+  release(&ideq.lock);
 }
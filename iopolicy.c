@@ -0,0 +1,21 @@
+// Choose the disk scheduling policy.
+// Usage: iopolicy fifo|elevator|deadline
+// Type ^P on the console to see each policy's latency.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+int
+main(int argc, char *argv[])
+{
+  if(argc != 2){
+    printf(2, "usage: iopolicy fifo|elevator|deadline\n");
+    exit();
+  }
+  if(iosched(argv[1]) < 0){
+    printf(2, "iopolicy: no policy %s\n", argv[1]);
+    exit();
+  }
+  exit();
+}
@@ -0,0 +1,308 @@
+// I/O scheduler.
+//
+// Each disk driver owns an ioqueue.  iosubmit() adds a buffer
+// to the queue of its device and returns; iowait() waits for
+// it to finish, and iorw() does both.  Several buffers can be
+// submitted before waiting for any of them.  A buffer marked
+// B_ASYNC is released by bdone() when it finishes instead.
+//
+// Whenever the driver has room for a request, the queue's
+// policy picks the waiting buffer to start next, and iostart()
+// adds any waiting buffers for the blocks right after it, in
+// the same direction, up to the driver's maxblocks.  The driver
+// moves the chain of buffers, linked through qnext, in one
+// command, and calls iodone() on its first buffer from the
+// interrupt handler when it finishes, then iostart() to refill
+// itself.  The queue lock protects the driver's state too:
+// start() is called, and iodone() must be called, with it held.
+//
+// Policies:
+// * fifo: arrival order.
+// * elevator: C-LOOK, the next block at or above the last one
+//     started, wrapping around to the lowest.
+// * deadline: elevator, except that a request that has waited
+//     longer than its deadline goes first, an expired read
+//     before an expired write.  Reads, which a process is
+//     usually waiting for, expire sooner than writes.
+//
+// The policy is chosen with the iosched() system call.  Each
+// queue keeps latency statistics for every policy, charging
+// each request to the policy in force when it was queued; ^P
+// on the console prints them.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "iosched.h"
+
+#define NDISK 2
+
+#define READ_EXPIRE   (HZ/2)     // Deadlines, in ticks
+#define WRITE_EXPIRE  (5*HZ)
+
+struct iopolicy {
+  char *name;
+  struct buf* (*pick)(struct ioqueue*);
+};
+
+static struct buf* fifopick(struct ioqueue*);
+static struct buf* elevpick(struct ioqueue*);
+static struct buf* deadlinepick(struct ioqueue*);
+
+static struct iopolicy policies[NIOPOLICY] = {
+  { "fifo",     fifopick },
+  { "elevator", elevpick },
+  { "deadline", deadlinepick },
+};
+
+static struct iopolicy *policy = &policies[2];
+static struct ioqueue *disk[NDISK];
+
+static struct buf*
+fifopick(struct ioqueue *q)
+{
+  return q->pending;
+}
+
+static struct buf*
+elevpick(struct ioqueue *q)
+{
+  struct buf *b, *up, *low;
+
+  up = low = 0;
+  for(b = q->pending; b; b = b->qnext){
+    if(b->blockno >= q->pos && (up == 0 || b->blockno < up->blockno))
+      up = b;
+    if(low == 0 || b->blockno < low->blockno)
+      low = b;
+  }
+  return up ? up : low;
+}
+
+static struct buf*
+deadlinepick(struct ioqueue *q)
+{
+  struct buf *b, *w;
+
+  // The list is in arrival order, so the first expired read
+  // or write is the oldest one.  Reads and writes share it, so
+  // look past a write that has not expired yet.
+  w = 0;
+  for(b = q->pending; b; b = b->qnext){
+    if(b->flags & B_DIRTY){
+      if(w == 0 && ticks - b->qtime >= WRITE_EXPIRE)
+        w = b;
+    } else if(ticks - b->qtime >= READ_EXPIRE)
+      return b;
+  }
+  if(w)
+    return w;
+  return elevpick(q);
+}
+
+void
+ioqinit(struct ioqueue *q, char *name, int depth, int maxblocks,
+        void (*start)(struct buf*))
+{
+  initlock(&q->lock, name);
+  q->name = name;
+  q->depth = depth;
+  q->maxblocks = maxblocks;
+  q->start = start;
+}
+
+// Send requests for dev to q, replacing any earlier queue.
+void
+ioattach(uint dev, struct ioqueue *q)
+{
+  if(dev >= NDISK)
+    panic("ioattach");
+  disk[dev] = q;
+}
+
+// Take b off q's waiting list.
+static void
+unqueue(struct ioqueue *q, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &q->pending; *pp != b; pp = &(*pp)->qnext)
+    ;
+  *pp = b->qnext;
+}
+
+// Return the waiting buffer that would continue the request
+// ending with b, or 0.
+static struct buf*
+nextblock(struct ioqueue *q, struct buf *b)
+{
+  struct buf *nb;
+
+  for(nb = q->pending; nb; nb = nb->qnext)
+    if(nb->dev == b->dev && nb->blockno == b->blockno + 1 &&
+       (nb->flags & B_DIRTY) == (b->flags & B_DIRTY))
+      return nb;
+  return 0;
+}
+
+// Start waiting requests while the driver has room.
+// Caller must hold q->lock.
+void
+iostart(struct ioqueue *q)
+{
+  struct buf *b, *last, *nb;
+  int n;
+
+  while(q->busy < q->depth && q->pending){
+    b = policy->pick(q);
+    unqueue(q, b);
+    last = b;
+    for(n = 1; n < q->maxblocks && (nb = nextblock(q, last)) != 0; n++){
+      unqueue(q, nb);
+      last->qnext = nb;
+      last = nb;
+    }
+    last->qnext = 0;
+    q->busy++;
+    q->pos = last->blockno;
+    q->start(b);
+  }
+}
+
+// The driver has finished the request starting with b.
+// Caller must hold q->lock.
+void
+iodone(struct ioqueue *q, struct buf *b)
+{
+  struct buf *nb;
+  struct iostat *s;
+  uint64 now;
+  uint lat;
+
+  q->busy--;
+  now = rdtsc();
+  for(; b; b = nb){
+    nb = b->qnext;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+
+    // Another CPU may have queued b, and its counter may be
+    // a little behind ours.
+    lat = now > b->qtsc ? (now - b->qtsc) >> 10 : 0;
+    s = &q->stat[b->qpolicy];
+    s->n++;
+    s->sum += lat;
+    if(lat > s->max)
+      s->max = lat;
+
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      bdone(b);
+    } else
+      wakeup(b);
+  }
+}
+
+static struct ioqueue*
+ioqueue(uint dev)
+{
+  if(dev >= NDISK || disk[dev] == 0)
+    panic("iosched: no disk");
+  return disk[dev];
+}
+
+//PAGEBREAK!
+// Queue b to be synced with disk, and return.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// b must stay locked until iowait() returns or, for a B_ASYNC
+// buffer, until bdone() releases it.
+void
+iosubmit(struct buf *b)
+{
+  struct ioqueue *q;
+  struct buf **pp;
+
+  if(!holdingsleep(&b->lock))
+    panic("iosubmit: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("iosubmit: nothing to do");
+  q = ioqueue(b->dev);
+
+  acquire(&q->lock);
+
+  // Append b to the queue; the policy picks from it.
+  b->qnext = 0;
+  b->qtime = ticks;
+  b->qtsc = rdtsc();
+  b->qpolicy = policy - policies;
+  for(pp = &q->pending; *pp; pp = &(*pp)->qnext)
+    ;
+  *pp = b;
+  iostart(q);
+
+  release(&q->lock);
+}
+
+// Wait for a submitted buffer to finish.
+void
+iowait(struct buf *b)
+{
+  struct ioqueue *q;
+
+  q = ioqueue(b->dev);
+  acquire(&q->lock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &q->lock);
+  release(&q->lock);
+}
+
+// Sync buf with disk, and wait for it.
+void
+iorw(struct buf *b)
+{
+  iosubmit(b);
+  iowait(b);
+}
+
+// Use the policy called name.  Returns -1 if there is none.
+int
+iosetpolicy(char *name)
+{
+  struct iopolicy *p;
+
+  for(p = policies; p < policies+NIOPOLICY; p++){
+    if(strncmp(p->name, name, 16) == 0){
+      policy = p;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+void
+iodump(void)
+{
+  struct ioqueue *q;
+  struct iostat *s;
+  int i, j;
+
+  for(i = 0; i < NDISK; i++){
+    q = disk[i];
+    if(q == 0 || (i > 0 && q == disk[i-1]))
+      continue;
+    for(j = 0; j < NIOPOLICY; j++){
+      s = &q->stat[j];
+      if(s->n == 0)
+        continue;
+      cprintf("%s %s%s: %d requests, latency avg %d max %d x1024 cycles\n",
+              q->name, policies[j].name, &policies[j] == policy ? "*" : "",
+              s->n, s->sum / s->n, s->max);
+    }
+  }
+}
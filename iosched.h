@@ -0,0 +1,22 @@
+// Disk request queue, between the buffer cache and a driver.
+// See iosched.c.
+
+#define NIOPOLICY 3
+
+struct iostat {
+  uint n;                // Requests completed
+  uint sum;              // Total latency, in units of 1024 cycles
+  uint max;              // Worst latency, in units of 1024 cycles
+};
+
+struct ioqueue {
+  struct spinlock lock;  // Protects the queue and the driver
+  char *name;
+  int depth;             // Requests the driver can have at once
+  int busy;              // Requests the driver has
+  int maxblocks;         // Most blocks in one request
+  void (*start)(struct buf*); // Give b to the driver; lock held
+  struct buf *pending;   // Waiting, in arrival order, through qnext
+  uint pos;              // Block of the last request started
+  struct iostat stat[NIOPOLICY]; // Per policy
+};
@@ -1,39 +1,190 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
 // and pipe buffers. Allocates 4096-byte pages.
+//
+// The RAM to manage comes from the BIOS memory map that
+// bootasm.S leaves at E820MAP, so holes and reserved areas
+// are never handed out.  Memory above PHYSLIMIT is ignored,
+// since the kernel cannot map it.
+//
+// Free memory is kept by a buddy allocator: blocks of 2^k
+// pages, 0 <= k < MAXORDER, each aligned to its own size, on
+// one free list per order.  kallocpages() splits a larger
+// block when no block of the wanted order is free, and
+// kfreepages() merges a freed block with its buddy (the
+// other half of the block of the next order up) whenever the
+// buddy is free too, so physically contiguous runs of pages
+// are available for callers that need them.
+//
+// Each CPU keeps a small cache of free single pages that only
+// it touches, with interrupts off, so most kalloc() and kfree()
+// calls take no lock.  An empty cache refills from the buddy
+// allocator, and an overfull one drains to it, KBATCH pages
+// at a time under kmem.lock.  Up to KCACHEMAX pages per CPU
+// can sit in other CPUs' caches when kalloc() reports that
+// memory has run out.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "x86.h"
+
+#define KBATCH     32            // pages moved per refill or drain
+#define KCACHEMAX  (2*KBATCH)    // drain a cache above this
+#define MAXORDER   11            // largest block is 2^10 pages, 4MB
+#define NMEMRANGE  32            // most usable RAM ranges remembered
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+// Entry in the BIOS (INT 0x15, AX=0xE820) memory map.
+struct e820 {
+  uint addr;
+  uint addrhi;
+  uint len;
+  uint lenhi;
+  uint type;
+};
+
+#define E820_RAM  1              // usable RAM
+
+// Usable RAM, physical [start, end), below PHYSLIMIT.
+static struct memrange {
+  uint start;
+  uint end;
+} memrange[NMEMRANGE];
+static int nmemrange;
+
+uint phystop;    // Top of usable physical memory
+
 struct run {
   struct run *next;
+  struct run *prev;        // Used only on the buddy lists
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run free[MAXORDER];  // Circular lists of free blocks
+  uint nfree;                 // Pages on the free lists
+  uint npage;                 // phystop/PGSIZE
+  // For the first page of each free block, 1 + the block's
+  // order; 0 for every other page.
+  uchar *order;
+  // Number of references to each physical page, so that
+  // copy-on-write fork can share pages between processes.
+  // Updated with atomic instructions, not under the lock.
+  // A page is referenced at most once per region of each
+  // process, plus once by the page cache, so NPROC*NVMA + 1
+  // bounds the count; a byte would not hold that.
+  ushort *ref;
 } kmem;
 
+#if NPROC*NVMA + 1 > 0xffff
+#error "kmem.ref too narrow for NPROC*NVMA"
+#endif
+
+// Per-CPU free page cache.
+struct kcache {
+  struct run *freelist;
+  int n;               // pages on freelist
+  uint nalloc;         // kalloc() calls served on this CPU
+  uint nfree;          // pages freed on this CPU
+  uint nrefill;        // batches taken from the buddy lists
+  uint ndrain;         // batches given back to the buddy lists
+};
+
+static struct kcache kcache[NCPU];
+
+static void
+addrange(uint start, uint end)
+{
+  struct memrange *m;
+
+  if(end > PHYSLIMIT)
+    end = PHYSLIMIT;
+  if(start >= end || nmemrange == NMEMRANGE)
+    return;
+  // Don't trust the BIOS not to list memory twice.
+  for(m = memrange; m < &memrange[nmemrange]; m++)
+    if(start < m->end && m->start < end)
+      return;
+  memrange[nmemrange].start = start;
+  memrange[nmemrange].end = end;
+  nmemrange++;
+  if(end > phystop)
+    phystop = end;
+}
+
+// Find the usable RAM and set phystop.
+static void
+meminit(void)
+{
+  struct e820 *e;
+  uint n, i, len;
+
+  n = *(uint*)P2V(E820MAP);
+  e = (struct e820*)P2V(E820MAP+4);
+  if(n > E820MAX)
+    n = E820MAX;
+  for(i = 0; i < n; i++, e++){
+    if(e->type != E820_RAM || e->addrhi != 0)
+      continue;
+    len = e->lenhi ? 0xFFFFFFFF : e->len;
+    if(len > 0xFFFFFFFF - e->addr)
+      len = 0xFFFFFFFF - e->addr;
+    addrange(e->addr, e->addr + len);
+  }
+  if(nmemrange == 0){
+    // No E820 map.  CMOS 0x34-0x35 holds the number of
+    // 64KB blocks above 16MB, and 0x30-0x31 the number of
+    // 1KB blocks above 1MB, up to 64MB.
+    n = cmos_read(0x34) | cmos_read(0x35) << 8;
+    if(n)
+      addrange(EXTMEM, 16*1024*1024 + n*64*1024);
+    else
+      addrange(EXTMEM, EXTMEM + (cmos_read(0x30) | cmos_read(0x31) << 8)*1024);
+  }
+  if(phystop < 4*1024*1024)
+    panic("meminit: too little memory");
+}
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// The per-CPU caches are used only after kinit2(), because
+// before that there may be no way to tell which CPU we are.
+// kinit1() also finds out how much memory there is, and takes
+// the per-page arrays, sized to match, from the start of
+// [vstart, vend).
 void
 kinit1(void *vstart, void *vend)
 {
+  char *p;
+  int k;
+
   initlock(&kmem.lock, "kmem");
   kmem.use_lock = 0;
-  freerange(vstart, vend);
+  for(k = 0; k < MAXORDER; k++)
+    kmem.free[k].next = kmem.free[k].prev = &kmem.free[k];
+  meminit();
+  kmem.npage = phystop / PGSIZE;
+  p = (char*)PGROUNDUP((uint)vstart);
+  kmem.ref = (ushort*)p;
+  kmem.order = (uchar*)(kmem.ref + kmem.npage);
+  p = (char*)PGROUNDUP((uint)(kmem.order + kmem.npage));
+  if(p > (char*)vend)
+    panic("kinit1");
+  memset(kmem.ref, 0, kmem.npage*sizeof(kmem.ref[0]));
+  memset(kmem.order, 0, kmem.npage);
+  freerange(p, vend);
 }
 
 void
@@ -43,37 +194,162 @@ kinit2(void *vstart, void *vend)
   kmem.use_lock = 1;
 }
 
+// Free the usable pages in [vstart, vend).
 void
 freerange(void *vstart, void *vend)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
-    kfree(p);
+  struct memrange *m;
+  uint lo, hi, pa;
+
+  for(m = memrange; m < &memrange[nmemrange]; m++){
+    lo = PGROUNDUP(m->start > V2P(vstart) ? m->start : V2P(vstart));
+    hi = PGROUNDDOWN(m->end < V2P(vend) ? m->end : V2P(vend));
+    for(pa = lo; pa + PGSIZE <= hi; pa += PGSIZE){
+      kmem.ref[pa/PGSIZE] = 1;
+      kfree(P2V(pa));
+    }
+  }
+}
+
+static void
+runlink(struct run *head, struct run *r)
+{
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+}
+
+static void
+rununlink(struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+}
+
+// Return the block of 2^order pages at v to the free lists,
+// merging it with free buddies.  Caller must hold kmem.lock
+// (or be initializing).
+static void
+buddyfree(char *v, int order)
+{
+  uint pfn, b;
+
+  pfn = V2P(v) / PGSIZE;
+  kmem.nfree += 1 << order;
+  while(order < MAXORDER-1){
+    b = pfn ^ (1 << order);
+    if(b >= kmem.npage || kmem.order[b] != order+1)
+      break;
+    rununlink((struct run*)P2V(b*PGSIZE));
+    kmem.order[b] = 0;
+    pfn &= ~(1 << order);
+    order++;
+  }
+  kmem.order[pfn] = order+1;
+  runlink(&kmem.free[order], (struct run*)P2V(pfn*PGSIZE));
+}
+
+// Take a block of 2^order pages off the free lists,
+// splitting a larger block if necessary.  Returns 0 if there
+// is none.  Caller must hold kmem.lock (or be initializing).
+static char*
+buddyalloc(int order)
+{
+  struct run *r;
+  uint pfn, half;
+  int k;
+
+  for(k = order; k < MAXORDER; k++)
+    if(kmem.free[k].next != &kmem.free[k])
+      break;
+  if(k == MAXORDER)
+    return 0;
+  r = kmem.free[k].next;
+  rununlink(r);
+  kmem.nfree -= 1 << order;
+  pfn = V2P(r) / PGSIZE;
+  kmem.order[pfn] = 0;
+  while(k > order){
+    k--;
+    half = pfn + (1 << k);
+    kmem.order[half] = k+1;
+    runlink(&kmem.free[k], (struct run*)P2V(half*PGSIZE));
+  }
+  return (char*)r;
+}
+
+// Move up to n pages from the buddy allocator to c.
+// Caller must hold kmem.lock.
+static void
+refill(struct kcache *c, int n)
+{
+  struct run *r;
+
+  while(n-- > 0 && (r = (struct run*)buddyalloc(0)) != 0){
+    r->next = c->freelist;
+    c->freelist = r;
+    c->n++;
+  }
+  c->nrefill++;
+}
+
+// Move n pages from c back to the buddy allocator.
+// Caller must hold kmem.lock.
+static void
+drain(struct kcache *c, int n)
+{
+  struct run *r;
+
+  while(n-- > 0 && (r = c->freelist) != 0){
+    c->freelist = r->next;
+    c->n--;
+    buddyfree((char*)r, 0);
+  }
+  c->ndrain++;
 }
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when the last reference goes.
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *c;
 
-  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
     panic("kfree");
 
+  if(kmem.ref[V2P(v)/PGSIZE] == 0)
+    panic("kfree: ref");
+  if(__sync_sub_and_fetch(&kmem.ref[V2P(v)/PGSIZE], 1) > 0)
+    return;
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    buddyfree(v, 0);
+    return;
+  }
+
+  pushcli();
+  c = &kcache[cpuid()];
+  r->next = c->freelist;
+  c->freelist = r;
+  c->n++;
+  c->nfree++;
+  if(c->n > KCACHEMAX){
+    acquire(&kmem.lock);
+    drain(c, KBATCH);
     release(&kmem.lock);
+  }
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +359,138 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
+
+  if(!kmem.use_lock){
+    r = (struct run*)buddyalloc(0);
+  } else {
+    pushcli();
+    c = &kcache[cpuid()];
+    if(c->freelist == 0){
+      acquire(&kmem.lock);
+      refill(c, KBATCH);
+      release(&kmem.lock);
+    }
+    if((r = c->freelist) != 0){
+      c->freelist = r->next;
+      c->n--;
+      c->nalloc++;
+    }
+    popcli();
+  }
+  if(r)
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+  return (char*)r;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their total size.  Returns a pointer that the kernel can
+// use, or 0 if no such run of pages is free.  Free with
+// kfreepages() and the same order, not kfree().
+char*
+kallocpages(int order)
+{
+  char *v;
+  uint pfn, i;
+
+  if(order < 0 || order >= MAXORDER)
+    return 0;
+  if(!kmem.use_lock){
+    v = buddyalloc(order);
+  } else {
+    pushcli();
+    acquire(&kmem.lock);
+    // Pages in this CPU's cache may be holding buddies apart.
+    if((v = buddyalloc(order)) == 0 && order > 0){
+      drain(&kcache[cpuid()], KCACHEMAX+1);
+      v = buddyalloc(order);
+    }
+    release(&kmem.lock);
+    popcli();
+  }
+  if(v){
+    pfn = V2P(v) / PGSIZE;
+    for(i = 0; i < (1 << order); i++)
+      kmem.ref[pfn+i] = 1;
+  }
+  return v;
+}
+
+// Free 2^order pages at v, which came from kallocpages(order).
+void
+kfreepages(char *v, int order)
+{
+  uint pfn, i;
 
+  if((uint)v % (PGSIZE << order) || v < end || V2P(v) >= phystop)
+    panic("kfreepages");
+  pfn = V2P(v) / PGSIZE;
+  for(i = 0; i < (1 << order); i++){
+    if(kmem.ref[pfn+i] != 1)
+      panic("kfreepages: ref");
+    kmem.ref[pfn+i] = 0;
+  }
+  memset(v, 1, PGSIZE << order);
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  buddyfree(v, order);
   if(kmem.use_lock)
     release(&kmem.lock);
-  return (char*)r;
 }
 
+// Return the number of free pages, including those in the
+// per-CPU caches.  Only an estimate, since it takes no locks.
+int
+kfreecount(void)
+{
+  struct kcache *c;
+  int n;
+
+  n = kmem.nfree;
+  for(c = kcache; c < &kcache[ncpu]; c++)
+    n += c->n;
+  return n;
+}
+
+// Add a reference to the allocated page at v.
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
+    panic("kref");
+  if(kmem.ref[V2P(v)/PGSIZE] == 0)
+    panic("kref: ref");
+  if(__sync_add_and_fetch(&kmem.ref[V2P(v)/PGSIZE], 1) == 0)
+    panic("kref: overflow");
+}
+
+// Return the number of references to the page at v.
+int
+krefcnt(char *v)
+{
+  return kmem.ref[V2P(v)/PGSIZE];
+}
+
+// Print the per-CPU allocator counters.  For debugging.
+// Runs when user types ^P on console.
+void
+kallocdump(void)
+{
+  struct kcache *c;
+  struct run *r;
+  int k, n;
+
+  for(c = kcache; c < &kcache[ncpu]; c++)
+    cprintf("cpu%d: kalloc %d kfree %d cached %d refill %d drain %d\n",
+            c - kcache, c->nalloc, c->nfree, c->n, c->nrefill, c->ndrain);
+  acquire(&kmem.lock);
+  cprintf("free blocks:");
+  for(k = 0; k < MAXORDER; k++){
+    n = 0;
+    for(r = kmem.free[k].next; r != &kmem.free[k]; r = r->next)
+      n++;
+    cprintf(" %d", n);
+  }
+  cprintf("\n");
+  release(&kmem.lock);
+}
@@ -42,6 +42,7 @@
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
 volatile uint *lapic;  // Initialized in mp.c
+static uint lapicticr; // Timer count for one clock tick
 
 //PAGEBREAK!
 static void
@@ -51,9 +52,42 @@ lapicw(int index, int value)
   lapic[ID];  // wait for write to finish, by reading
 }
 
+#define PIT_HZ      1193182   // PIT input clock
+#define CALIBRATE_MS 10
+#define MIN_TIMER_HZ 1000000   // Slower than this, calibration failed
+
+// Count how far the timer runs down in CALIBRATE_MS,
+// measured with PIT channel 2 (the speaker channel, whose
+// output can be read back through port 0x61).
+static uint
+lapiccalibrate(void)
+{
+  uint count = PIT_HZ * CALIBRATE_MS / 1000;
+  uchar gate;
+
+  gate = inb(0x61) & ~0x03;   // gate low, speaker off
+  outb(0x61, gate);
+  outb(0x43, 0xB0);           // channel 2, lo/hi byte, one-shot
+  outb(0x42, count & 0xFF);
+  outb(0x42, count >> 8);
+
+  lapicw(TDCR, X1);
+  lapicw(TIMER, MASKED);
+  lapicw(TICR, 0xFFFFFFFF);
+  outb(0x61, gate | 0x01);    // start the PIT count
+  while((inb(0x61) & 0x20) == 0 && lapic[TCCR] != 0)
+    ;
+  count = 0xFFFFFFFF - lapic[TCCR];
+  lapicw(TICR, 0);
+  outb(0x61, gate);
+  return count;
+}
+
 void
 lapicinit(void)
 {
+  uint n;
+
   if(!lapic)
     return;
 
@@ -62,11 +96,21 @@ lapicinit(void)
 
   // The timer repeatedly counts down at bus frequency
   // from lapic[TICR] and then issues an interrupt.
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
-  lapicw(TDCR, X1);
-  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  // The boot CPU calibrates TICR against the PIT to get HZ
+  // interrupts per second; the others reuse its answer.
+  // Fall back to the old fixed count if the PIT is missing:
+  // then port 0x61 may read as all ones, the wait ends at
+  // once, and the count is implausibly small.
+  if(lapicticr == 0){
+    n = lapiccalibrate();
+    if(n < MIN_TIMER_HZ / 1000 * CALIBRATE_MS || n == 0xFFFFFFFF)
+      lapicticr = 10000000;
+    else
+      lapicticr = n / HZ * (1000 / CALIBRATE_MS);
+    if(lapicticr == 0)
+      lapicticr = 1;
+  }
+  lapicstarttimer();
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -97,6 +141,39 @@ lapicinit(void)
   lapicw(TPR, 0);
 }
 
+// Start periodic clock interrupts on this CPU.
+void
+lapicstarttimer(void)
+{
+  if(!lapic)
+    return;
+  lapicw(TDCR, X1);
+  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, lapicticr);
+}
+
+// Stop clock interrupts on this CPU, e.g. while it is idle.
+void
+lapicstoptimer(void)
+{
+  if(!lapic)
+    return;
+  lapicw(TIMER, MASKED | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, 0);
+}
+
+// Send interrupt vector to the CPU with the given APIC ID.
+void
+lapicipi(int apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 int
 lapicid(void)
 {
@@ -171,7 +248,7 @@ lapicstartap(uchar apicid, uint addr)
 #define MONTH   0x08
 #define YEAR    0x09
 
-static uint cmos_read(uint reg)
+uint cmos_read(uint reg)
 {
   outb(CMOS_PORT,  reg);
   microdelay(200);
@@ -27,7 +27,11 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous.  Blocks are copied to and from
+// the log LOGBATCH at a time, all started before waiting for
+// any, so the disk can do adjacent ones in one request.
+
+#define LOGBATCH 8
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -69,15 +73,24 @@ initlog(int dev)
 static void
 install_trans(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  struct buf *dbuf[LOGBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail < LOGBATCH ? log.lh.n - tail : LOGBATCH;
+    for (i = 0; i < n; i++)
+      breadahead(log.dev, log.start+tail+i+1);
+    for (i = 0; i < n; i++) {
+      struct buf *lbuf = bread(log.dev, log.start+tail+i+1); // read log block
+      dbuf[i] = bclaim(log.dev, log.lh.block[tail+i]); // dst, overwritten
+      memmove(dbuf[i]->data, lbuf->data, BSIZE);  // copy block to dst
+      bwritestart(dbuf[i]);  // write dst to disk
+      brelse(lbuf);
+    }
+    for (i = 0; i < n; i++) {
+      bwait(dbuf[i]);
+      brelse(dbuf[i]);
+    }
   }
 }
 
@@ -177,15 +190,22 @@ end_op(void)
 static void
 write_log(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  struct buf *to[LOGBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail < LOGBATCH ? log.lh.n - tail : LOGBATCH;
+    for (i = 0; i < n; i++) {
+      to[i] = bclaim(log.dev, log.start+tail+i+1); // log block
+      struct buf *from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      memmove(to[i]->data, from->data, BSIZE);
+      bwritestart(to[i]);  // write the log
+      brelse(from);
+    }
+    for (i = 0; i < n; i++) {
+      bwait(to[i]);
+      brelse(to[i]);
+    }
   }
 }
 
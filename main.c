@@ -28,11 +28,15 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
-  binit();         // buffer cache
   fileinit();      // file table
+  icacheinit();    // inode cache
+  pipeinit();      // pipe buffers
   ideinit();       // disk 
+  virtioinit();    // virtio disk
   startothers();   // start other processors
-  kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  kinit2(P2V(4*1024*1024), P2V(phystop)); // must come after startothers()
+  binit();         // buffer cache
+  pcacheinit();    // page cache
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -41,7 +45,7 @@ main(void)
 static void
 mpenter(void)
 {
-  switchkvm();
+  kvmenable();
   seginit();
   lapicinit();
   mpmain();
@@ -12,17 +12,23 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iosched.h"
 
 extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
 
 static int disksize;
 static uchar *memdisk;
+static struct ioqueue ideq;
+
+static void idestart(struct buf*);
 
 void
 ideinit(void)
 {
   memdisk = _binary_fs_img_start;
   disksize = (uint)_binary_fs_img_size/BSIZE;
+  ioqinit(&ideq, "memide", 1, 1, idestart);
+  ioattach(1, &ideq);
 }
 
 // Interrupt handler.
@@ -32,29 +38,23 @@ ideintr(void)
   // no-op
 }
 
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Copy b to or from the memory disk; it is done at once.
+// Caller must hold ideq.lock.
+static void
+idestart(struct buf *b)
 {
   uchar *p;
 
-  if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
   if(b->dev != 1)
-    panic("iderw: request not for disk 1");
+    panic("idestart: request not for disk 1");
   if(b->blockno >= disksize)
-    panic("iderw: block out of range");
+    panic("idestart: block out of range");
 
   p = memdisk + b->blockno*BSIZE;
 
-  if(b->flags & B_DIRTY){
-    b->flags &= ~B_DIRTY;
+  if(b->flags & B_DIRTY)
     memmove(p, b->data, BSIZE);
-  } else
+  else
     memmove(b->data, p, BSIZE);
-  b->flags |= B_VALID;
+  iodone(&ideq, b);
 }
@@ -0,0 +1,9 @@
+// mmap() protection and flags
+#define PROT_READ      0x1     // Pages may be read
+#define PROT_WRITE     0x2     // Pages may be written
+
+#define MAP_SHARED     0x01    // Writes go to the file, seen by children
+#define MAP_PRIVATE    0x02    // Writes are private copies
+#define MAP_ANONYMOUS  0x20    // Zero-filled, no file
+
+#define MAP_FAILED     ((void*)-1)
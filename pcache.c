@@ -0,0 +1,365 @@
+// Page cache.
+//
+// The page cache holds whole pages of file and directory
+// contents, indexed by (dev, inum, page number), so that a
+// file that is read again, or mapped with mmap(), comes from
+// memory instead of from the disk.  It sits above the buffer
+// cache: pages are filled with bread(), and writei() writes
+// through both, so the log sees every change made by write().
+// The exception is a page mapped into a MAP_SHARED, writable
+// region: stores through the mapping land in the cached page
+// at once, so read() sees them, but the disk does not until
+// vmawriteback() writes the page back at munmap() or exit().
+// Until then the cached page is dirty and must not be
+// recycled, which holds since it stays mapped.
+//
+// Interface:
+// * readi() calls pcacheread() to copy file data out.
+// * writei() calls pcachewrite() to update cached pages.
+// * vmafill() calls pcachemap() to map a cached page itself.
+// * ireadahead() calls pcachehas() to skip cached pages.
+// * itrunc() calls pcacheinval() to forget a file's pages.
+// * pcacheshrink() gives pages back when memory runs low.
+//
+// All of these run with the inode locked, so only one process
+// at a time fills, reads or writes a given file's pages.  The
+// hash table and LRU list are protected by pcache.lock.  A
+// page is not reused while a reader holds it (ref > 0) or
+// while a process has it mapped (krefcnt() > 1).
+//
+// The cache grows while there is free memory to spare: up to
+// half the memory free at boot, and never below a reserve of
+// an eighth of it.  Past that, the least recently used page
+// is recycled.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "file.h"
+#include "slab.h"
+
+#define NPCHASH 1024
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint pgno;               // Page number within the file
+  int ref;                 // Readers copying out of data
+  char *data;              // The page, from kalloc()
+  struct cpage *hnext;     // Hash chain
+  struct cpage *prev;      // LRU list
+  struct cpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct objcache cache;   // struct cpage allocator
+  struct cpage *hash[NPCHASH];
+  // LRU list of all pages, through prev/next.
+  // head.next is most recently used.
+  struct cpage head;
+  uint n;                  // Pages in the cache
+  uint max;                // Most pages to allocate
+  uint reserve;            // Free pages to leave alone
+  uint hits;
+  uint misses;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  objcacheinit(&pcache.cache, "cpage", sizeof(struct cpage));
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  pcache.max = kfreecount() / 2;
+  pcache.reserve = kfreecount() / 8;
+}
+
+static struct cpage**
+bucket(uint dev, uint inum, uint pgno)
+{
+  return &pcache.hash[(dev*31 + inum*17 + pgno) % NPCHASH];
+}
+
+// Caller must hold pcache.lock.
+static struct cpage*
+lookup(uint dev, uint inum, uint pgno)
+{
+  struct cpage *pg;
+
+  for(pg = *bucket(dev, inum, pgno); pg; pg = pg->hnext)
+    if(pg->dev == dev && pg->inum == inum && pg->pgno == pgno)
+      return pg;
+  return 0;
+}
+
+// Take pg out of the hash table and LRU list.
+// Caller must hold pcache.lock.
+static void
+unlink(struct cpage *pg)
+{
+  struct cpage **pp;
+
+  for(pp = bucket(pg->dev, pg->inum, pg->pgno); *pp != pg; pp = &(*pp)->hnext)
+    ;
+  *pp = pg->hnext;
+  pg->next->prev = pg->prev;
+  pg->prev->next = pg->next;
+}
+
+// Find the least recently used page that no one is using,
+// and take it out of the cache.  Returns 0 if there is none.
+// Caller must hold pcache.lock.
+static struct cpage*
+victim(void)
+{
+  struct cpage *pg;
+
+  for(pg = pcache.head.prev; pg != &pcache.head; pg = pg->prev){
+    if(pg->ref == 0 && krefcnt(pg->data) == 1){
+      unlink(pg);
+      return pg;
+    }
+  }
+  return 0;
+}
+
+// Free a page that is no longer in the cache.
+static void
+pfree(struct cpage *pg)
+{
+  kfree(pg->data);
+  objfree(&pcache.cache, pg);
+  acquire(&pcache.lock);
+  pcache.n--;
+  release(&pcache.lock);
+}
+
+// Get a page to fill: a new one if the cache may grow,
+// otherwise a recycled one.  Returns 0 if there is none.
+static struct cpage*
+palloc(void)
+{
+  struct cpage *pg;
+
+  if(pcache.n < pcache.max && kfreecount() > pcache.reserve){
+    if((pg = objalloc(&pcache.cache)) != 0){
+      if((pg->data = kalloc()) != 0){
+        acquire(&pcache.lock);
+        pcache.n++;
+        release(&pcache.lock);
+        return pg;
+      }
+      objfree(&pcache.cache, pg);
+    }
+  }
+  acquire(&pcache.lock);
+  pg = victim();
+  release(&pcache.lock);
+  return pg;
+}
+
+// Return the page holding page pgno of ip, filling it from
+// the disk if it is not cached, with its ref raised.
+// Returns 0 if there is no memory for it.
+// Caller must hold ip->lock, and pgno must be in the file.
+static struct cpage*
+pget(struct inode *ip, uint pgno)
+{
+  struct cpage *pg, **b;
+  struct buf *bp;
+  uint off, m;
+
+  acquire(&pcache.lock);
+  if((pg = lookup(ip->dev, ip->inum, pgno)) != 0){
+    pg->ref++;
+    pcache.hits++;
+    // Move to the head of the MRU list.
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+    pcache.head.next->prev = pg;
+    pcache.head.next = pg;
+    release(&pcache.lock);
+    return pg;
+  }
+  pcache.misses++;
+  release(&pcache.lock);
+
+  if((pg = palloc()) == 0)
+    return 0;
+  // No one else can be filling this page: that would need
+  // ip->lock too.
+  memset(pg->data, 0, PGSIZE);
+  for(off = 0; off < PGSIZE && pgno*PGSIZE + off < ip->size; off += m){
+    bp = bread(ip->dev, bmap(ip, (pgno*PGSIZE + off) / BSIZE));
+    m = BSIZE;
+    memmove(pg->data + off, bp->data, m);
+    brelse(bp);
+  }
+  if(pgno*PGSIZE + PGSIZE > ip->size)
+    memset(pg->data + ip->size%PGSIZE, 0, PGSIZE - ip->size%PGSIZE);
+
+  acquire(&pcache.lock);
+  pg->dev = ip->dev;
+  pg->inum = ip->inum;
+  pg->pgno = pgno;
+  pg->ref = 1;
+  b = bucket(pg->dev, pg->inum, pg->pgno);
+  pg->hnext = *b;
+  *b = pg;
+  pg->next = pcache.head.next;
+  pg->prev = &pcache.head;
+  pcache.head.next->prev = pg;
+  pcache.head.next = pg;
+  release(&pcache.lock);
+  return pg;
+}
+
+static void
+pput(struct cpage *pg)
+{
+  acquire(&pcache.lock);
+  pg->ref--;
+  release(&pcache.lock);
+}
+
+// Copy n bytes of ip from offset off to dst, reading through
+// the cache.  The range must lie within the file.
+// Caller must hold ip->lock.
+void
+pcacheread(struct inode *ip, char *dst, uint off, uint n)
+{
+  struct cpage *pg;
+  struct buf *bp;
+  uint tot, m;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if((pg = pget(ip, off/PGSIZE)) == 0){
+      // No memory to cache it; read the block directly.
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
+      m = min(n - tot, BSIZE - off%BSIZE);
+      memmove(dst, bp->data + off%BSIZE, m);
+      brelse(bp);
+      continue;
+    }
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    memmove(dst, pg->data + off%PGSIZE, m);
+    pput(pg);
+  }
+}
+
+// Copy n bytes from src into any cached pages of ip at offset
+// off, for writei(), which writes them to the disk itself.
+// Caller must hold ip->lock.
+void
+pcachewrite(struct inode *ip, char *src, uint off, uint n)
+{
+  struct cpage *pg;
+  uint tot, m;
+
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    acquire(&pcache.lock);
+    if((pg = lookup(ip->dev, ip->inum, off/PGSIZE)) != 0)
+      pg->ref++;
+    release(&pcache.lock);
+    if(pg){
+      memmove(pg->data + off%PGSIZE, src, m);
+      pput(pg);
+    }
+  }
+}
+
+// Return the cached page of ip at offset off, with an extra
+// kalloc() reference for the caller to map and later kfree(),
+// if off is page aligned and the page holds no more than the
+// n bytes wanted: n is a whole page or the file ends first.
+// Returns 0 otherwise, or if there is no memory.
+// Caller must hold ip->lock.
+char*
+pcachemap(struct inode *ip, uint off, uint n)
+{
+  struct cpage *pg;
+  char *mem;
+
+  if(off % PGSIZE != 0 || off >= ip->size)
+    return 0;
+  if(n < PGSIZE && off + n < ip->size)
+    return 0;
+  if((pg = pget(ip, off/PGSIZE)) == 0)
+    return 0;
+  mem = pg->data;
+  kref(mem);
+  pput(pg);
+  return mem;
+}
+
+// Is the page of ip holding offset off in the cache?
+int
+pcachehas(struct inode *ip, uint off)
+{
+  int r;
+
+  acquire(&pcache.lock);
+  r = lookup(ip->dev, ip->inum, off/PGSIZE) != 0;
+  release(&pcache.lock);
+  return r;
+}
+
+// Drop all cached pages of ip, whose contents are going away.
+// itrunc() only runs once the last reference to ip is gone,
+// and every mmap() region holds a reference, so no shared
+// region still has one of these pages mapped.  A process that
+// exec()ed the file may still have a page mapped privately,
+// until its page table is freed; it keeps the page.
+// Caller must hold ip->lock.
+void
+pcacheinval(struct inode *ip)
+{
+  struct cpage *pg;
+  uint pgno;
+
+  for(pgno = 0; pgno < (ip->size + PGSIZE - 1) / PGSIZE; pgno++){
+    acquire(&pcache.lock);
+    if((pg = lookup(ip->dev, ip->inum, pgno)) != 0)
+      unlink(pg);
+    release(&pcache.lock);
+    if(pg)
+      pfree(pg);
+  }
+}
+
+// Free up to n cached pages that no one is using, least
+// recently used first.  Returns the number freed.
+int
+pcacheshrink(int n)
+{
+  struct cpage *pg;
+  int i;
+
+  for(i = 0; i < n; i++){
+    acquire(&pcache.lock);
+    pg = victim();
+    release(&pcache.lock);
+    if(pg == 0)
+      break;
+    pfree(pg);
+  }
+  return i;
+}
+
+void
+pcachedump(void)
+{
+  cprintf("pcache: %d pages, max %d, hits %d misses %d\n",
+          pcache.n, pcache.max, pcache.hits, pcache.misses);
+}
@@ -0,0 +1,103 @@
+// PCI bus enumeration, through configuration mechanism #1:
+// write the address of a configuration register to CONFADDR,
+// then read or write its value at CONFDATA.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define CONFADDR  0xcf8
+#define CONFDATA  0xcfc
+
+#define NBUS   256
+#define NDEV   32
+#define NFUNC  8
+
+static uint
+confaddr(struct pcidev *d, uint off)
+{
+  return 0x80000000 | d->bus<<16 | d->dev<<11 | d->func<<8 | (off & 0xfc);
+}
+
+uint
+pciread(struct pcidev *d, uint off)
+{
+  outl(CONFADDR, confaddr(d, off));
+  return inl(CONFDATA);
+}
+
+void
+pciwrite(struct pcidev *d, uint off, uint v)
+{
+  outl(CONFADDR, confaddr(d, off));
+  outl(CONFDATA, v);
+}
+
+// Fill in the rest of d, whose bus, dev and func are set.
+// Returns 0 if there is no such function.
+static int
+pciprobe(struct pcidev *d)
+{
+  uint id, class, bar;
+  int i;
+
+  id = pciread(d, PCI_ID);
+  if((id & 0xffff) == 0xffff)
+    return 0;
+  d->vendor = id & 0xffff;
+  d->device = id >> 16;
+  class = pciread(d, PCI_CLASS);
+  d->class = class >> 24;
+  d->subclass = (class >> 16) & 0xff;
+  for(i = 0; i < 6; i++){
+    bar = pciread(d, PCI_BAR0 + 4*i);
+    if(bar & PCI_BAR_IO)
+      d->bar[i] = bar & ~0x3;
+    else
+      d->bar[i] = bar & ~0xf;
+  }
+  d->irq = pciread(d, PCI_INTR) & 0xff;
+  return 1;
+}
+
+// Find the first function that matches vendor, device, class
+// and subclass, any of which may be PCI_ANY, and fill in d.
+// Returns 0 if there is none.
+int
+pcifind(int vendor, int device, int class, int subclass, struct pcidev *d)
+{
+  uint nfunc;
+
+  for(d->bus = 0; d->bus < NBUS; d->bus++){
+    for(d->dev = 0; d->dev < NDEV; d->dev++){
+      nfunc = 1;
+      for(d->func = 0; d->func < nfunc; d->func++){
+        if(!pciprobe(d))
+          continue;
+        if(d->func == 0 && ((pciread(d, PCI_HDR) >> 16) & PCI_HDR_MF))
+          nfunc = NFUNC;
+        if((vendor == PCI_ANY || d->vendor == vendor) &&
+           (device == PCI_ANY || d->device == device) &&
+           (class == PCI_ANY || d->class == class) &&
+           (subclass == PCI_ANY || d->subclass == subclass))
+          return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Turn on the address spaces the device decodes and let it
+// master the bus.
+void
+pcienable(struct pcidev *d)
+{
+  uint cmd;
+
+  // The upper half is the status register, whose bits are
+  // cleared by writing ones; leave it alone.
+  cmd = pciread(d, PCI_CMD) & 0xffff;
+  cmd |= PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER;
+  pciwrite(d, PCI_CMD, cmd);
+}
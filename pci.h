@@ -0,0 +1,32 @@
+// PCI configuration space.
+// See PCI Local Bus Specification 3.0, chapter 6.
+
+#define PCI_ANY         (-1)       // Wildcard for pcifind()
+
+// Configuration space registers.
+#define PCI_ID          0x00       // Device ID << 16 | vendor ID
+#define PCI_CMD         0x04       // Command (low 16 bits)
+  #define PCI_CMD_IO      0x0001   // Respond to I/O space accesses
+  #define PCI_CMD_MEM     0x0002   // Respond to memory space accesses
+  #define PCI_CMD_MASTER  0x0004   // Allow bus mastering (DMA)
+#define PCI_CLASS       0x08       // Class << 24 | subclass << 16 | progif << 8
+#define PCI_HDR         0x0c       // Header type in bits 16-23
+  #define PCI_HDR_MF      0x80     // Multi-function device
+#define PCI_BAR0        0x10       // Base address registers, 6 of them
+  #define PCI_BAR_IO      0x1      // I/O space, not memory
+#define PCI_INTR        0x3c       // Interrupt line in the low byte
+
+#define PCI_CLASS_STORAGE 0x01
+  #define PCI_SUB_IDE       0x01
+
+struct pcidev {
+  uint bus;
+  uint dev;
+  uint func;
+  uint vendor;
+  uint device;
+  uint class;
+  uint subclass;
+  uint bar[6];          // Base addresses, with the type bits masked off
+  uint irq;             // Interrupt line the BIOS routed it to
+};
@@ -6,12 +6,49 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "traps.h"
+
+#define NWAITQ 64   // wait channel hash buckets; power of two
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct proc *waitq[NWAITQ];  // SLEEPING processes, hashed by chan
 } ptable;
 
+// Per-CPU run queues.  A process is on exactly one run queue
+// exactly when its state is RUNNABLE.  Each CPU's scheduler
+// takes processes off the head of its own queue, so choosing
+// the next process is O(1), and a CPU with an empty queue
+// never touches ptable.lock.
+//
+// Each queue is a multi-level feedback queue with one FIFO
+// list per priority level.  A process that uses up its time
+// slice drops a level; one that sleeps keeps its level.  A
+// process never drops below NPRIO-1, and starts each run of
+// feedback at its base priority p->nice.  To keep busy high
+// levels from starving lower ones, a process that has waited
+// AGETICKS on a queue moves up a level (see dequeue).
+//
+// ptable.lock still protects p->state and must be held to
+// add a process to a queue or to take one off to run it.
+// Each queue's lock protects its lists, so that a queue can be
+// examined or rearranged without ptable.lock.
+// Lock order: ptable.lock, then runq locks.
+#define AGETICKS 10
+
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];    // Next process to run at each level
+  struct proc *tail[NPRIO];    // Most recently queued at each level
+  volatile int n;              // Number of queued processes
+  volatile uint idle;          // Owning CPU is halted in idle()
+  uint steals;                 // Processes this CPU took from others
+  uint stolen;                 // Processes others took from this CPU
+};
+
+static struct runq runqs[NCPU];
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -23,7 +60,245 @@ static void wakeup1(void *chan);
 void
 pinit(void)
 {
+  struct runq *rq;
+
   initlock(&ptable.lock, "ptable");
+  for(rq = runqs; rq < &runqs[NCPU]; rq++)
+    initlock(&rq->lock, "runq");
+}
+
+// Append p to the tail of rq at level p->prio.
+// Caller must hold rq->lock.
+static void
+enqueue(struct runq *rq, struct proc *p)
+{
+  int l;
+
+  l = p->prio;
+  p->cpu = rq - runqs;
+  p->rqnext = 0;
+  p->rqtick = ticks;
+  if(rq->tail[l])
+    rq->tail[l]->rqnext = p;
+  else
+    rq->head[l] = p;
+  rq->tail[l] = p;
+  rq->n++;
+}
+
+// Remove and return the process at the head of level l of rq.
+// Caller must hold rq->lock.
+static struct proc*
+unlinkhead(struct runq *rq, int l)
+{
+  struct proc *p;
+
+  if((p = rq->head[l]) != 0){
+    rq->head[l] = p->rqnext;
+    if(rq->head[l] == 0)
+      rq->tail[l] = 0;
+    p->rqnext = 0;
+    rq->n--;
+  }
+  return p;
+}
+
+// Remove and return the highest-priority process on rq, or 0.
+// Caller must hold rq->lock.
+// First age the queue: each list is in arrival order, so only
+// its head can have waited AGETICKS, and checking the heads
+// keeps this O(NPRIO).
+static struct proc*
+dequeue(struct runq *rq)
+{
+  struct proc *p;
+  int l;
+
+  for(l = 1; l < NPRIO; l++){
+    p = rq->head[l];
+    if(p && ticks - p->rqtick >= AGETICKS){
+      unlinkhead(rq, l);
+      p->prio = l - 1;
+      enqueue(rq, p);
+    }
+  }
+  for(l = 0; l < NPRIO; l++)
+    if(rq->head[l])
+      return unlinkhead(rq, l);
+  return 0;
+}
+
+// Wake a CPU to run the process just queued on rq: rq's
+// owner if it is idle, or, if rq has more waiting than its
+// owner will take next, any idle CPU, which will steal one.
+// release() in runqput is a full barrier, so this read of
+// v->idle cannot pass the n++; idle() sets v->idle before
+// checking n, so either it sees the work or we see it idle.
+static void
+runqkick(struct runq *rq)
+{
+  struct runq *v, *self;
+
+  pushcli();
+  self = &runqs[cpuid()];
+  if(!rq->idle && rq->n > 1)
+    for(v = runqs; v < &runqs[ncpu]; v++)
+      if(v->idle){
+        rq = v;
+        break;
+      }
+  if(rq->idle && rq != self)
+    lapicipi(cpus[rq - runqs].apicid, T_IRQ0 + IRQ_WAKEUP);
+  popcli();
+}
+
+static void
+runqput(struct runq *rq, struct proc *p)
+{
+  acquire(&rq->lock);
+  enqueue(rq, p);
+  release(&rq->lock);
+  runqkick(rq);
+}
+
+static struct proc*
+runqget(struct runq *rq)
+{
+  struct proc *p;
+
+  acquire(&rq->lock);
+  p = dequeue(rq);
+  release(&rq->lock);
+  if(p && p->state != RUNNABLE)
+    panic("runqget");
+  return p;
+}
+
+// Return the index of the CPU with the shortest run queue.
+// The lengths are read without locks; a stale answer only
+// costs some balance, not correctness.
+static int
+runqidle(void)
+{
+  int i, best;
+
+  best = 0;
+  for(i = 1; i < ncpu; i++)
+    if(runqs[i].n < runqs[best].n)
+      best = i;
+  return best;
+}
+
+// Move one process from the longest other run queue onto rq,
+// which belongs to an idle CPU.  Taking a single process is
+// enough to give the idle CPU work and disturbs the victim's
+// locality as little as possible; if there is more imbalance,
+// the next idle pass will steal again.  Only queue membership
+// changes, so ptable.lock is not needed.  Returns the number
+// of processes moved.
+static int
+runqsteal(struct runq *rq)
+{
+  struct runq *victim, *v, *first, *second;
+  struct proc *p;
+
+  victim = 0;
+  for(v = runqs; v < &runqs[ncpu]; v++)
+    if(v != rq && v->n > 0 && (victim == 0 || v->n > victim->n))
+      victim = v;
+  if(victim == 0)
+    return 0;
+
+  // Lock in address order so that two CPUs stealing from
+  // each other cannot deadlock.
+  if(rq < victim){
+    first = rq;
+    second = victim;
+  } else {
+    first = victim;
+    second = rq;
+  }
+  acquire(&first->lock);
+  acquire(&second->lock);
+
+  // Recheck now that the queues are locked.
+  if((p = dequeue(victim)) != 0){
+    enqueue(rq, p);
+    victim->stolen++;
+    rq->steals++;
+  }
+
+  release(&second->lock);
+  release(&first->lock);
+  return p != 0;
+}
+
+// Return the head of the wait queue bucket for chan.
+// Channels are usually addresses of kernel objects, so
+// drop the low bits that alignment makes mostly zero.
+static struct proc**
+waitqbucket(void *chan)
+{
+  uint h;
+
+  h = (uint)chan;
+  h = (h >> 3) ^ (h >> 12);
+  return &ptable.waitq[h & (NWAITQ-1)];
+}
+
+// Remove SLEEPING process p from its wait queue bucket.
+// The ptable lock must be held.
+static void
+waitqremove(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = waitqbucket(p->chan); *pp; pp = &(*pp)->wqnext){
+    if(*pp == p){
+      *pp = p->wqnext;
+      p->wqnext = 0;
+      return;
+    }
+  }
+  panic("waitqremove");
+}
+
+// Halt this CPU until there may be something to run.
+// CPU 0 keeps its clock running because it maintains ticks;
+// the other CPUs also stop their timers, so an idle CPU takes
+// no interrupts at all until runqkick() or a device wakes it.
+static void
+idle(struct runq *rq)
+{
+  struct runq *v;
+  int stopped;
+
+  cli();
+  xchg(&rq->idle, 1);
+  for(v = runqs; v < &runqs[ncpu]; v++)
+    if(v->n > 0)
+      goto out;
+  stopped = rq != runqs;
+  if(stopped)
+    lapicstoptimer();
+  stihlt();
+  cli();
+  if(stopped)
+    lapicstarttimer();
+out:
+  xchg(&rq->idle, 0);
+  sti();
+}
+
+// Mark p RUNNABLE and put it on the run queue of p->cpu.
+// The ptable lock must be held.
+static void
+setrunnable(struct proc *p)
+{
+  if(!holding(&ptable.lock))
+    panic("setrunnable");
+  p->state = RUNNABLE;
+  runqput(&runqs[p->cpu], p);
 }
 
 // Must be called with interrupts disabled
@@ -148,12 +423,16 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  p->nice = p->prio = NPRIO/2;
+  p->cpu = runqidle();
+  setrunnable(p);
 
   release(&ptable.lock);
 }
 
 // Grow current process's memory by n bytes.
+// Growth only moves sz; pagefault() allocates each new
+// page the first time it is touched.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -163,8 +442,10 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if(sz + n < sz || sz + n >= KERNBASE ||
+       vmaoverlap(curproc, PGROUNDUP(sz), PGROUNDUP(sz + n)))
       return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
@@ -190,7 +471,7 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz, curproc->vma)) == 0){
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
@@ -207,6 +488,7 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  dupvmas(np->vma, curproc->vma);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -214,7 +496,9 @@ fork(void)
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  np->nice = np->prio = curproc->nice;
+  np->cpu = runqidle();
+  setrunnable(np);
 
   release(&ptable.lock);
 
@@ -242,8 +526,10 @@ exit(void)
     }
   }
 
+  vmaunmap(curproc, 0, KERNBASE);
   begin_op();
   iput(curproc->cwd);
+  freevmas(curproc->vma);
   end_op();
   curproc->cwd = 0;
 
@@ -324,18 +610,24 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  struct runq *rq = &runqs[cpuid()];
   c->proc = 0;
   
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
+    // Nothing to run here; try to take work from a busier
+    // CPU, and don't bother other CPUs for ptable.lock if
+    // there is none.
+    if(rq->n == 0 && runqsteal(rq) == 0){
+      idle(rq);
+      continue;
+    }
 
+    // Take the process at the head of this CPU's run queue.
+    acquire(&ptable.lock);
+    if((p = runqget(rq)) != 0){
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
       // before jumping back to us.
@@ -382,11 +674,19 @@ sched(void)
 }
 
 // Give up the CPU for one scheduling round.
+// Called when the process has used up its time slice,
+// so it drops a priority level.
 void
 yield(void)
 {
+  struct proc *p = myproc();
+
   acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  if(p->prio < p->nice)
+    p->prio = p->nice;  // aged up; back to its own level
+  else if(p->prio < NPRIO-1)
+    p->prio++;
+  setrunnable(p);
   sched();
   release(&ptable.lock);
 }
@@ -438,6 +738,8 @@ sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->wqnext = *waitqbucket(chan);
+  *waitqbucket(chan) = p;
 
   sched();
 
@@ -454,14 +756,25 @@ sleep(void *chan, struct spinlock *lk)
 //PAGEBREAK!
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
+// Only the sleepers in chan's bucket are examined.
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  struct proc *p, **pp;
+
+  pp = waitqbucket(chan);
+  while((p = *pp) != 0){
+    if(p->chan == chan){
+      *pp = p->wqnext;
+      p->wqnext = 0;
+      // Go back to the CPU p last ran on, for its cache,
+      // unless that CPU is busy and another one is not.
+      if(cpus[p->cpu].proc != 0)
+        p->cpu = runqidle();
+      setrunnable(p);
+    } else
+      pp = &p->wqnext;
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -486,8 +799,10 @@ kill(int pid)
     if(p->pid == pid){
       p->killed = 1;
       // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
+      if(p->state == SLEEPING){
+        waitqremove(p);
+        setrunnable(p);
+      }
       release(&ptable.lock);
       return 0;
     }
@@ -496,6 +811,46 @@ kill(int pid)
   return -1;
 }
 
+// Set the base priority of the process with the given pid.
+// Takes effect the next time the process is queued.
+int
+setpriority(int pid, int prio)
+{
+  struct proc *p;
+
+  if(prio < 0 || prio >= NPRIO)
+    return -1;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      p->nice = p->prio = prio;
+      release(&ptable.lock);
+      return 0;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Return the base priority of the process with the given pid.
+int
+getpriority(int pid)
+{
+  struct proc *p;
+  int prio;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      prio = p->nice;
+      release(&ptable.lock);
+      return prio;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -513,9 +868,14 @@ procdump(void)
   };
   int i;
   struct proc *p;
+  struct runq *rq;
   char *state;
   uint pc[10];
 
+  for(rq = runqs; rq < &runqs[ncpu]; rq++)
+    cprintf("cpu%d: runq %d steals %d stolen %d\n",
+            rq - runqs, rq->n, rq->steals, rq->stolen);
+
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->state == UNUSED)
       continue;
@@ -523,7 +883,7 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
+    cprintf("%d %s %s prio %d/%d", p->pid, state, p->name, p->prio, p->nice);
     if(p->state == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
@@ -32,6 +32,23 @@ struct context {
   uint eip;
 };
 
+// A region of user memory whose pages are read from a file,
+// or zeroed, the first time they are touched (see pagefault
+// in vm.c).  exec() makes one per program segment, below sz;
+// mmap() makes them between sz and KERNBASE.
+struct vma {
+  uint start;                  // First address, page aligned
+  uint end;                    // One past last address, page aligned; 0 if unused
+  struct inode *ip;            // File holding the contents, or 0
+  uint off;                    // File offset of start
+  uint filesz;                 // Bytes of file data; the rest is zeros
+  int flags;                   // VMA_ flags below
+};
+
+#define VMA_WRITE   0x1        // Pages are writable
+#define VMA_SHARED  0x2        // Shared with children; writes go to the file
+#define VMA_MMAP    0x4        // Made by mmap()
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -48,7 +65,14 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // Demand-paged regions
   char name[16];               // Process name (debugging)
+  int cpu;                     // Run queue this process belongs to
+  int nice;                    // Base priority, set by setpriority
+  int prio;                    // Current priority level
+  uint rqtick;                 // When last put on a run queue
+  struct proc *rqnext;         // Next process on run queue
+  struct proc *wqnext;         // Next sleeper in same wait channel bucket
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,194 @@
+// Slab allocator for small kernel objects.
+//
+// An objcache hands out objects of one size.  Objects live in
+// slabs: single pages from kalloc() with a struct slab header
+// at the start and the objects after it, so the slab of an
+// object is found by rounding its address down to a page.
+// Free objects in a slab are linked through their first word.
+//
+// In front of the slabs, each CPU has a magazine, a small
+// stack of free objects that only that CPU touches, with
+// interrupts off.  objalloc() and objfree() take the cache
+// lock only to refill an empty magazine or to empty a full
+// one, half a magazine at a time.
+//
+// A slab whose objects are all free goes back to kalloc(), so
+// a cache's memory follows its current use.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct slab {
+  struct slab *next;       // Cache's list of slabs with free objects
+  struct slab *prev;
+  struct objcache *cache;
+  int inuse;               // Objects handed out or in magazines
+  void *free;              // Free objects in this slab
+};
+
+#define SLABHDR ((sizeof(struct slab) + 7) & ~7)
+
+void
+objcacheinit(struct objcache *c, char *name, uint size)
+{
+  memset(c, 0, sizeof(*c));
+  initlock(&c->lock, name);
+  c->name = name;
+  if(size < sizeof(void*))
+    size = sizeof(void*);
+  c->size = (size + 7) & ~7;
+  c->perslab = (PGSIZE - SLABHDR) / c->size;
+  if(c->perslab == 0)
+    panic("objcacheinit: too big");
+}
+
+// Link s into c's list of slabs with free objects.
+static void
+slablink(struct objcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->slabs;
+  if(c->slabs)
+    c->slabs->prev = s;
+  c->slabs = s;
+}
+
+static void
+slabunlink(struct objcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->slabs = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+// Allocate and carve a new slab for c.
+// Caller must hold c->lock.
+static struct slab*
+slabgrow(struct objcache *c)
+{
+  struct slab *s;
+  char *obj;
+  uint i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  obj = (char*)s + SLABHDR;
+  for(i = 0; i < c->perslab; i++, obj += c->size){
+    *(void**)obj = s->free;
+    s->free = obj;
+  }
+  slablink(c, s);
+  c->nslab++;
+  return s;
+}
+
+// Take up to n objects from c's slabs and put them in m.
+// Caller must hold c->lock.
+static void
+magfill(struct objcache *c, int m, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  while(n-- > 0){
+    if((s = c->slabs) == 0 && (s = slabgrow(c)) == 0)
+      break;
+    obj = s->free;
+    s->free = *(void**)obj;
+    s->inuse++;
+    if(s->free == 0)
+      slabunlink(c, s);
+    c->mag[m].obj[c->mag[m].n++] = obj;
+  }
+}
+
+// Return n objects from m to their slabs.
+// Caller must hold c->lock.
+static void
+magdrain(struct objcache *c, int m, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  while(n-- > 0 && c->mag[m].n > 0){
+    obj = c->mag[m].obj[--c->mag[m].n];
+    s = (struct slab*)PGROUNDDOWN((uint)obj);
+    if(s->cache != c)
+      panic("objfree: wrong cache");
+    if(s->free == 0)
+      slablink(c, s);
+    *(void**)obj = s->free;
+    s->free = obj;
+    if(--s->inuse == 0){
+      slabunlink(c, s);
+      c->nslab--;
+      kfree((char*)s);
+    }
+  }
+}
+
+// Allocate an object from c.
+// Returns 0 if the memory cannot be allocated.
+void*
+objalloc(struct objcache *c)
+{
+  void *obj;
+  int m;
+
+  obj = 0;
+  pushcli();
+  m = cpuid();
+  if(c->mag[m].n == 0){
+    acquire(&c->lock);
+    magfill(c, m, MAGSIZE/2);
+    release(&c->lock);
+  }
+  if(c->mag[m].n > 0)
+    obj = c->mag[m].obj[--c->mag[m].n];
+  popcli();
+  return obj;
+}
+
+// Return the objects in this CPU's magazine to their slabs,
+// so that any slab left with no objects in use goes back to
+// kalloc().  Other CPUs' magazines are theirs alone to touch.
+void
+objreap(struct objcache *c)
+{
+  int m;
+
+  pushcli();
+  m = cpuid();
+  acquire(&c->lock);
+  magdrain(c, m, MAGSIZE);
+  release(&c->lock);
+  popcli();
+}
+
+// Free an object that came from objalloc(c).
+void
+objfree(struct objcache *c, void *obj)
+{
+  int m;
+
+  pushcli();
+  m = cpuid();
+  if(c->mag[m].n == MAGSIZE){
+    acquire(&c->lock);
+    magdrain(c, m, MAGSIZE/2);
+    release(&c->lock);
+  }
+  c->mag[m].obj[c->mag[m].n++] = obj;
+  popcli();
+}
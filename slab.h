@@ -0,0 +1,20 @@
+// Cache of fixed-size kernel objects, carved out of pages
+// from kalloc().  See slab.c.
+
+#define MAGSIZE 16   // objects per per-CPU magazine
+
+struct slab;
+
+struct objcache {
+  char *name;            // For debugging
+  uint size;             // Object size, rounded up
+  uint perslab;          // Objects per slab page
+  struct spinlock lock;  // Protects slabs and nslab
+  struct slab *slabs;    // Slabs with at least one free object
+  uint nslab;            // Pages in use by this cache
+  struct {
+    int n;               // Objects in obj[]
+    void *obj[MAGSIZE];
+  } mag[NCPU];           // Per-CPU magazine of free objects
+};
+
@@ -19,7 +19,9 @@ fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(!uvmvalid(curproc, addr, 4))
+    return -1;
+  if(uvmtouch(curproc, addr, 4, 0) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -34,11 +36,12 @@ fetchstr(uint addr, char **pp)
   char *s, *ep;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
-    return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
+  ep = (char*)KERNBASE;
   for(s = *pp; s < ep; s++){
+    if(s == *pp || ((uint)s % PGSIZE) == 0 || (uint)s == curproc->sz)
+      if(!uvmvalid(curproc, (uint)s, 1) || uvmtouch(curproc, (uint)s, 1, 0) < 0)
+        return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -63,16 +66,30 @@ argptr(int n, char **pp, int size)
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || !uvmvalid(curproc, i, size))
+    return -1;
+  if(uvmtouch(curproc, i, size, 0) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Like argptr, but for a block that the system call will
+// write: also check that it is writable.
+int
+argwptr(int n, char **pp, int size)
+{
+  if(argptr(n, pp, size) < 0)
+    return -1;
+  if(uvmtouch(myproc(), (uint)*pp, size, 1) < 0)
+    return -1;
+  return 0;
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (A string in a MAP_SHARED region can still be changed by
+// another process after this check.)
 int
 argstr(int n, char **pp)
 {
@@ -103,6 +120,11 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_setpriority(void);
+extern int sys_getpriority(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_iosched(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -126,6 +148,11 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_setpriority] sys_setpriority,
+[SYS_getpriority] sys_getpriority,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_iosched] sys_iosched,
 };
 
 void
@@ -20,3 +20,8 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_setpriority 22
+#define SYS_getpriority 23
+#define SYS_mmap   24
+#define SYS_munmap 25
+#define SYS_iosched 26
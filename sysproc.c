@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "timer.h"
 
 int
 sys_fork(void)
@@ -61,17 +62,22 @@ sys_sleep(void)
 {
   int n;
   uint ticks0;
+  struct timer t;
 
   if(argint(0, &n) < 0)
     return -1;
   acquire(&tickslock);
   ticks0 = ticks;
+  t.pprev = 0;
   while(ticks - ticks0 < n){
     if(myproc()->killed){
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    // Only the clock tick at our deadline wakes us.
+    timeradd(&t, ticks0 + n);
+    sleep(&t, &tickslock);
+    timerdel(&t);  // in case kill() woke us early
   }
   release(&tickslock);
   return 0;
@@ -89,3 +95,23 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+int
+sys_setpriority(void)
+{
+  int pid, prio;
+
+  if(argint(0, &pid) < 0 || argint(1, &prio) < 0)
+    return -1;
+  return setpriority(pid, prio);
+}
+
+int
+sys_getpriority(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return getpriority(pid);
+}
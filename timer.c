@@ -0,0 +1,75 @@
+// Timer wheel.
+//
+// Processes waiting for a tick count (sys_sleep) register a
+// struct timer and sleep on it.  Timers hash into wheel slots
+// by expiry tick, so the clock interrupt only looks at the
+// one slot for the current tick and wakes only the sleepers
+// whose deadline has arrived, instead of waking every sleeper
+// on every tick.
+//
+// Timers due more than NSLOT ticks ahead share a slot with
+// earlier ones and are skipped until their own round comes up.
+// All wheel state is protected by tickslock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "timer.h"
+
+#define NSLOT 64   // power of two
+
+static struct timer *wheel[NSLOT];
+
+// Arm t to fire when ticks reaches expires.
+// Caller must hold tickslock.
+void
+timeradd(struct timer *t, uint expires)
+{
+  struct timer **slot;
+
+  if(!holding(&tickslock))
+    panic("timeradd");
+  if(t->pprev)
+    panic("timeradd: pending");
+  slot = &wheel[expires & (NSLOT-1)];
+  t->expires = expires;
+  t->next = *slot;
+  if(t->next)
+    t->next->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+}
+
+// Disarm t if it has not fired yet.
+// Caller must hold tickslock.
+void
+timerdel(struct timer *t)
+{
+  if(!holding(&tickslock))
+    panic("timerdel");
+  if(t->pprev == 0)
+    return;
+  *t->pprev = t->next;
+  if(t->next)
+    t->next->pprev = t->pprev;
+  t->next = 0;
+  t->pprev = 0;
+}
+
+// Fire the timers that expire at the current tick.
+// Called from the clock interrupt with tickslock held,
+// just after ticks has been advanced.
+void
+timerexpire(void)
+{
+  struct timer *t, *next;
+
+  for(t = wheel[ticks & (NSLOT-1)]; t; t = next){
+    next = t->next;
+    if((int)(ticks - t->expires) >= 0){
+      timerdel(t);
+      wakeup(t);
+    }
+  }
+}
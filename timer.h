@@ -0,0 +1,7 @@
+// Kernel timer, fired by the clock interrupt at a given tick.
+struct timer {
+  uint expires;          // Value of ticks at which to fire
+  struct timer *next;    // Next timer in the same wheel slot
+  struct timer **pprev;  // Link pointing at us; 0 if not pending
+};
+
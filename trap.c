@@ -51,11 +51,15 @@ trap(struct trapframe *tf)
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
-      wakeup(&ticks);
+      timerexpire();
       release(&tickslock);
     }
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_WAKEUP:
+    // Nothing to do; waking the CPU from hlt was the point.
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE:
     ideintr();
     lapiceoi();
@@ -78,8 +82,21 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // Copy-on-write and lazily allocated pages at user
+    // addresses, touched from user space or by the kernel
+    // copying to or from user memory.
+    if(myproc() && pagefault(myproc(), rcr2(), tf->err) == 0)
+      break;
+    // fall through
+
   //PAGEBREAK: 13
   default:
+    if(virtioirq >= 0 && tf->trapno == T_IRQ0 + virtioirq){
+      virtiointr();
+      lapiceoi();
+      break;
+    }
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
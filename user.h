@@ -23,6 +23,11 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int setpriority(int, int);
+int getpriority(int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int iosched(char*);
 
 // ulib.c
 int stat(char*, struct stat*);
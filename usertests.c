@@ -4,6 +4,7 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "mman.h"
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
@@ -400,6 +401,114 @@ preempt(void)
   printf(1, "preempt ok\n");
 }
 
+// setpriority/getpriority, inheritance across fork, and a
+// priority 0 process running ahead of lower priority ones.
+void
+priotest(void)
+{
+  int pid, old, i, fds[2], ready[2], gate[2];
+  char c;
+
+  printf(1, "priority test\n");
+  old = getpriority(getpid());
+  if(old < 0){
+    printf(1, "getpriority failed\n");
+    exit();
+  }
+  if(setpriority(getpid(), 0) != 0 || getpriority(getpid()) != 0){
+    printf(1, "setpriority failed\n");
+    exit();
+  }
+  if(setpriority(getpid(), -1) != -1 || setpriority(getpid(), 100) != -1){
+    printf(1, "setpriority accepted bad priority\n");
+    exit();
+  }
+  if(getpriority(-1) != -1 || setpriority(-1, 0) != -1){
+    printf(1, "priority of nonexistent pid\n");
+    exit();
+  }
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    c = getpriority(getpid()) == 0 ? 'y' : 'n';
+    write(fds[1], &c, 1);
+    exit();
+  }
+  if(read(fds[0], &c, 1) != 1 || c != 'y'){
+    printf(1, "child did not inherit priority\n");
+    exit();
+  }
+  wait();
+  close(fds[0]);
+  close(fds[1]);
+  setpriority(getpid(), old);
+
+  // NCPU processes at the lowest priority and one at priority
+  // 0 wait on the same pipe, so one write makes them all
+  // runnable at once.  Each reports when it runs.  There are
+  // more of them than CPUs, so some CPU must choose among
+  // them, and the priority 0 one must not come last.
+  if(pipe(fds) != 0 || pipe(ready) != 0 || pipe(gate) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  for(i = 0; i <= NCPU; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      c = i == NCPU ? 'h' : 'l';
+      setpriority(getpid(), c == 'h' ? 0 : NPRIO-1);
+      write(ready[1], "r", 1);
+      if(read(gate[0], buf, 1) == 1)
+        write(fds[1], &c, 1);
+      exit();
+    }
+  }
+  close(ready[1]);
+  close(gate[0]);
+  close(fds[1]);
+  for(i = 0; i <= NCPU; i++){
+    if(read(ready[0], &c, 1) != 1){
+      printf(1, "priority: child failed\n");
+      exit();
+    }
+  }
+  memset(buf, 'g', NCPU+1);
+  write(gate[1], buf, NCPU+1);
+  for(i = 0; i <= NCPU; i++){
+    if(read(fds[0], &c, 1) != 1){
+      printf(1, "priority: child failed\n");
+      exit();
+    }
+    if(c == 'h')
+      break;
+  }
+  if(i == NCPU){
+    printf(1, "priority 0 process ran last\n");
+    exit();
+  }
+  if(i > NCPU){
+    printf(1, "priority 0 process did not run\n");
+    exit();
+  }
+  close(fds[0]);
+  close(ready[0]);
+  close(gate[1]);
+  for(i = 0; i <= NCPU; i++)
+    wait();
+  printf(1, "priority test ok\n");
+}
+
 // try to find any races between exit and wait
 void
 exitwait(void)
@@ -424,11 +533,14 @@ exitwait(void)
   printf(1, "exitwait ok\n");
 }
 
+#define MEMTOUCH (16*1024*1024)
+
 void
 mem(void)
 {
   void *m1, *m2;
-  int pid, ppid;
+  int pid, ppid, i, fds[2];
+  char *p, c;
 
   printf(1, "mem test\n");
   ppid = getpid();
@@ -450,11 +562,38 @@ mem(void)
       exit();
     }
     free(m1);
-    printf(1, "mem ok\n");
     exit();
-  } else {
-    wait();
   }
+  wait();
+
+  // sbrk() is lazy, so the child above usually does not see
+  // malloc() fail: it is killed in a page fault when memory runs
+  // out.  Either way, all of its memory must be free again, so
+  // another process can now touch a good amount of it.
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  if((pid = fork()) == 0){
+    close(fds[0]);
+    if((p = sbrk(MEMTOUCH)) == (char*)-1){
+      printf(1, "sbrk after mem failed\n");
+      kill(ppid);
+      exit();
+    }
+    for(i = 0; i < MEMTOUCH; i += 4096)
+      p[i] = 1;
+    write(fds[1], "x", 1);
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 1){
+    printf(1, "mem: memory not freed after running out\n");
+    exit();
+  }
+  close(fds[0]);
+  wait();
+  printf(1, "mem ok\n");
 }
 
 // More file system tests
@@ -1200,6 +1339,334 @@ bigfile(void)
   printf(1, "bigfile test ok\n");
 }
 
+// Reads see writes through the page cache: after a partial
+// overwrite of a cached page, after a file is removed and one
+// with the same name (and likely the same inode) created, and
+// after a write interrupts a sequential read that had read
+// ahead past it.
+void
+cachetest(void)
+{
+  int fd, i, n;
+
+  printf(1, "cache test\n");
+
+  unlink("cachef");
+  fd = open("cachef", O_CREATE|O_RDWR);
+  for(i = 0; i < 8192; i++)
+    buf[i] = 'a' + i % 26;
+  if(fd < 0 || write(fd, buf, 8192) != 8192){
+    printf(1, "cache: write cachef failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("cachef", O_RDWR);
+  if(read(fd, buf, 8192) != 8192 || buf[5000] != 'a' + 5000 % 26){
+    printf(1, "cache: read cachef failed\n");
+    exit();
+  }
+  close(fd);
+
+  // overwrite bytes 100-149 of the cached first page
+  fd = open("cachef", O_RDWR);
+  if(read(fd, buf, 100) != 100 || write(fd, "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX", 50) != 50){
+    printf(1, "cache: overwrite cachef failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("cachef", 0);
+  if(read(fd, buf, 8192) != 8192){
+    printf(1, "cache: read cachef failed\n");
+    exit();
+  }
+  for(i = 0; i < 8192; i++){
+    if(buf[i] != (i >= 100 && i < 150 ? 'X' : 'a' + i % 26)){
+      printf(1, "cache: wrong data after overwrite at %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+
+  // a new file under the same name does not see the old pages
+  unlink("cachef");
+  fd = open("cachef", O_CREATE|O_RDWR);
+  if(fd < 0 || read(fd, buf, 8192) != 0){
+    printf(1, "cache: recreated cachef not empty\n");
+    exit();
+  }
+  if(write(fd, "zzzz", 4) != 4){
+    printf(1, "cache: write cachef failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("cachef", 0);
+  if(read(fd, buf, 8192) != 4 || buf[0] != 'z' || buf[3] != 'z'){
+    printf(1, "cache: recreated cachef wrong\n");
+    exit();
+  }
+  close(fd);
+  unlink("cachef");
+
+  // read 20 blocks of a 40-block file in order, so readahead
+  // runs well past them, then overwrite blocks 20-24 with the
+  // same fd, which breaks the sequence, and read the rest
+  fd = open("cachef", O_CREATE|O_RDWR);
+  for(i = 0; i < 40; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf(1, "cache: write cachef failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  fd = open("cachef", O_RDWR);
+  for(i = 0; i < 20; i++){
+    if(read(fd, buf, BSIZE) != BSIZE || buf[0] != i || buf[BSIZE-1] != i){
+      printf(1, "cache: sequential read wrong at block %d\n", i);
+      exit();
+    }
+  }
+  memset(buf, 'W', 5*BSIZE);
+  if(write(fd, buf, 5*BSIZE) != 5*BSIZE){
+    printf(1, "cache: write cachef failed\n");
+    exit();
+  }
+  for(i = 25; i < 40; i++){
+    if(read(fd, buf, BSIZE) != BSIZE || buf[0] != i || buf[BSIZE-1] != i){
+      printf(1, "cache: read after write wrong at block %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  fd = open("cachef", 0);
+  for(i = 0; i < 40; i++){
+    n = i >= 20 && i < 25 ? 'W' : i;
+    if(read(fd, buf, BSIZE) != BSIZE || buf[0] != n || buf[BSIZE-1] != n){
+      printf(1, "cache: read back wrong at block %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  unlink("cachef");
+
+  printf(1, "cache test ok\n");
+}
+
+// Fill block blk of file f as written under policy k.
+static void
+iofill(char *p, int f, int blk, int k)
+{
+  int i;
+
+  for(i = 0; i < BSIZE; i++)
+    p[i] = f*31 + blk*7 + k + i;
+}
+
+// Check file f read back under policy k; 0 if it is intact.
+static int
+iocheck(char *name, int f, int k)
+{
+  char want[BSIZE];
+  int fd, blk, i;
+
+  fd = open(name, 0);
+  if(fd < 0)
+    return -1;
+  for(blk = 0; blk < 24; blk++){
+    if(read(fd, buf, BSIZE) != BSIZE){
+      close(fd);
+      return -1;
+    }
+    iofill(want, f, blk, k);
+    for(i = 0; i < BSIZE; i++){
+      if(buf[i] != want[i]){
+        close(fd);
+        return -1;
+      }
+    }
+  }
+  close(fd);
+  return 0;
+}
+
+// Write and read back files under each disk scheduling
+// policy.  The first 16 blocks of the two files are written
+// one at a time in turn, so their disk blocks interleave and
+// two concurrent readers queue requests out of order; the
+// last 8 go in one write, so the log installs adjacent blocks
+// the queue can merge.
+void
+iotest(void)
+{
+  static char *policy[] = { "fifo", "elevator", "deadline" };
+  char *names[] = { "iotest0", "iotest1" };
+  int fd[2], f, blk, k, pid, ppid;
+
+  printf(1, "iosched test\n");
+  ppid = getpid();
+
+  if(iosched("nosuchpolicy") != -1){
+    printf(1, "iosched accepted a bad policy\n");
+    exit();
+  }
+
+  for(k = 0; k < 3; k++){
+    if(iosched(policy[k]) != 0){
+      printf(1, "iosched %s failed\n", policy[k]);
+      exit();
+    }
+    for(f = 0; f < 2; f++){
+      fd[f] = open(names[f], O_CREATE|O_RDWR);
+      if(fd[f] < 0){
+        printf(1, "create %s failed\n", names[f]);
+        exit();
+      }
+    }
+    for(blk = 0; blk < 16; blk++){
+      for(f = 0; f < 2; f++){
+        iofill(buf, f, blk, k);
+        if(write(fd[f], buf, BSIZE) != BSIZE){
+          printf(1, "write %s failed\n", names[f]);
+          exit();
+        }
+      }
+    }
+    for(f = 0; f < 2; f++){
+      for(blk = 16; blk < 24; blk++)
+        iofill(buf + (blk-16)*BSIZE, f, blk, k);
+      if(write(fd[f], buf, 8*BSIZE) != 8*BSIZE){
+        printf(1, "write %s failed\n", names[f]);
+        exit();
+      }
+      close(fd[f]);
+    }
+
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      if(iocheck(names[0], 0, k) != 0){
+        printf(1, "%s: %s read back wrong\n", policy[k], names[0]);
+        kill(ppid);
+      }
+      exit();
+    }
+    if(iocheck(names[1], 1, k) != 0){
+      printf(1, "%s: %s read back wrong\n", policy[k], names[1]);
+      exit();
+    }
+    wait();
+    unlink(names[0]);
+    unlink(names[1]);
+  }
+
+  if(iosched("deadline") != 0){
+    printf(1, "iosched could not restore deadline\n");
+    exit();
+  }
+  printf(1, "iosched test ok\n");
+}
+
+// Many processes at once each write and read back a file in
+// transactions of several blocks, while another process uses
+// up all free memory.  The buffer cache must grow past NBUF,
+// let bget() wait for buffers and wake up, and give memory
+// back through bshrink(), without losing data or deadlocking.
+// ^P shows the peak size, waits and buffers given back.
+#define BCWRITERS 8
+#define BCROUNDS 4
+void
+bcachetest(void)
+{
+  char bcname[] = "bc0";
+  int i, n, r, pid, fd, fds[2], ready[2];
+  char c;
+
+  printf(1, "bcache test\n");
+  if(pipe(fds) != 0 || pipe(ready) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+
+  for(n = 0; n < BCWRITERS; n++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(fds[0]);
+      close(ready[0]);
+      bcname[2] = '0' + n;
+      c = 'y';
+      for(r = 0; r < BCROUNDS && c == 'y'; r++){
+        memset(buf, 'a' + n + r, sizeof(buf));
+        unlink(bcname);
+        fd = open(bcname, O_CREATE|O_RDWR);
+        if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf))
+          c = 'n';
+        close(fd);
+        memset(buf, 0, sizeof(buf));
+        fd = open(bcname, 0);
+        if(fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf))
+          c = 'n';
+        close(fd);
+        for(i = 0; i < sizeof(buf); i++)
+          if(buf[i] != 'a' + n + r)
+            c = 'n';
+        // After the first round, everything this process
+        // touches is mapped, so the memory hog cannot get it
+        // killed in a page fault.
+        if(r == 0)
+          write(ready[1], "r", 1);
+      }
+      unlink(bcname);
+      write(fds[1], &c, 1);
+      exit();
+    }
+  }
+  close(fds[1]);
+  close(ready[1]);
+  for(n = 0; n < BCWRITERS; n++){
+    if(read(ready[0], &c, 1) != 1){
+      printf(1, "bcache: writer failed\n");
+      exit();
+    }
+  }
+
+  // Touch pages until out of memory and killed in a page
+  // fault, a few times over.
+  pid = fork();
+  if(pid == 0){
+    for(i = 0; i < 4; i++){
+      if(fork() == 0){
+        for(;;)
+          *(sbrk(4096)) = 1;
+      }
+      wait();
+    }
+    exit();
+  }
+
+  for(n = 0; n < BCWRITERS; n++){
+    if(read(fds[0], &c, 1) != 1 || c != 'y'){
+      printf(1, "bcache: write or read back failed\n");
+      exit();
+    }
+  }
+  close(fds[0]);
+  close(ready[0]);
+  for(n = 0; n < BCWRITERS + 1; n++){
+    if(wait() < 0){
+      printf(1, "wait failed\n");
+      exit();
+    }
+  }
+  printf(1, "bcache test ok\n");
+}
+
 void
 fourteen(void)
 {
@@ -1347,7 +1814,7 @@ iref(void)
 
   printf(1, "empty file name\n");
 
-  // the 50 is NINODE
+  // the 50 was NINODE, when the inode cache was a fixed array
   for(i = 0; i < 50 + 1; i++){
     if(mkdir("irefd") != 0){
       printf(1, "mkdir irefd failed\n");
@@ -1411,6 +1878,78 @@ forktest(void)
   printf(1, "fork test OK\n");
 }
 
+// Copy-on-write fork: after fork() each side's writes to a
+// page they share stay private, including writes the kernel
+// makes into user memory for read().
+void
+cowtest(void)
+{
+  char *p, c;
+  int pid, i, fds[2], go[2];
+
+  printf(1, "cow test\n");
+  p = sbrk(3*4096);
+  if(p == (char*)-1){
+    printf(1, "sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < 3*4096; i++)
+    p[i] = 'a';
+  if(pipe(fds) != 0 || pipe(go) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    // Write the first page, wait for the parent to write the
+    // second, then read() into the third.
+    for(i = 0; i < 4096; i++)
+      p[i] = 'c';
+    write(fds[1], "w", 1);
+    c = 'y';
+    if(read(go[0], p + 2*4096, 1) != 1 || p[2*4096] != 'g')
+      c = 'n';
+    for(i = 4096; i < 3*4096; i++)
+      if(p[i] != (i == 2*4096 ? 'g' : 'a'))
+        c = 'n';
+    write(fds[1], &c, 1);
+    exit();
+  }
+
+  if(read(fds[0], &c, 1) != 1){
+    printf(1, "cow: no word from child\n");
+    exit();
+  }
+  for(i = 0; i < 4096; i++){
+    if(p[i] != 'a'){
+      printf(1, "cow: child's write seen by parent\n");
+      exit();
+    }
+  }
+  p[4096] = 'p';
+  write(go[1], "g", 1);
+  if(read(fds[0], &c, 1) != 1 || c != 'y'){
+    printf(1, "cow: parent's write or read() seen by child\n");
+    exit();
+  }
+  wait();
+  if(p[2*4096] != 'a'){
+    printf(1, "cow: child's read() seen by parent\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  close(go[0]);
+  close(go[1]);
+  sbrk(-3*4096);
+  printf(1, "cow test ok\n");
+}
+
 void
 sbrktest(void)
 {
@@ -1589,6 +2128,167 @@ validatetest(void)
   printf(stdout, "validate ok\n");
 }
 
+// anonymous and file-backed mmap, shared and private, and munmap
+void
+mmaptest(void)
+{
+  char *p;
+  int fd, fd1, i, pid, ppid;
+
+  printf(stdout, "mmap test\n");
+  ppid = getpid();
+
+  p = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap anonymous failed\n");
+    exit();
+  }
+  for(i = 0; i < 3*4096; i++){
+    if(p[i] != 0){
+      printf(stdout, "mmap anonymous not zero\n");
+      exit();
+    }
+  }
+  p[0] = 'a';
+  p[3*4096-1] = 'b';
+  if(munmap(p, 3*4096) < 0){
+    printf(stdout, "munmap failed\n");
+    exit();
+  }
+
+  // a child's writes to a shared mapping are seen by the parent
+  p = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap shared failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    p[10] = 'x';
+    exit();
+  }
+  wait();
+  if(p[10] != 'x'){
+    printf(stdout, "mmap shared write not seen\n");
+    exit();
+  }
+  munmap(p, 4096);
+
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "create mmapfile failed\n");
+    exit();
+  }
+  for(i = 0; i < 6000; i++)
+    buf[i] = 'A' + i % 26;
+  if(write(fd, buf, 6000) != 6000){
+    printf(stdout, "write mmapfile failed\n");
+    exit();
+  }
+
+  // a private mapping has the file contents, then zeros
+  p = mmap(0, 6000, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap file failed\n");
+    exit();
+  }
+  for(i = 0; i < 2*4096; i++){
+    if(p[i] != (i < 6000 ? buf[i] : 0)){
+      printf(stdout, "mmap file wrong contents\n");
+      exit();
+    }
+  }
+  p[0] = '!';
+  munmap(p, 6000);
+
+  // a shared mapping writes back to the file
+  p = mmap(0, 6000, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap file shared failed\n");
+    exit();
+  }
+  if(p[0] != 'A'){
+    printf(stdout, "mmap private write reached the file\n");
+    exit();
+  }
+  p[1] = '?';
+  p[5999] = '#';
+  munmap(p, 6000);
+  close(fd);
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, buf, sizeof(buf)) != 6000 || buf[1] != '?' || buf[5999] != '#'){
+    printf(stdout, "mmap shared write not in file\n");
+    exit();
+  }
+
+  // read-only mappings cannot be written, by the kernel or the user
+  p = mmap(0, 4096, PROT_READ, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap read-only failed\n");
+    exit();
+  }
+  if(read(fd, p, 10) != -1){
+    printf(stdout, "read into read-only mapping succeeded\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    p[0] = 'z';
+    printf(stdout, "wrote read-only mapping\n");
+    kill(ppid);
+    exit();
+  }
+  wait();
+  close(fd);
+
+  // unmapped memory is gone
+  munmap(p, 4096);
+  pid = fork();
+  if(pid == 0){
+    printf(stdout, "read unmapped memory %x\n", p[0]);
+    kill(ppid);
+    exit();
+  }
+  wait();
+
+  // stores to a shared mapping are seen by read() before they
+  // are written back, and the mapping keeps an unlinked file
+  fd = open("mmapfile", O_RDWR);
+  p = mmap(0, 6000, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap file shared failed\n");
+    exit();
+  }
+  p[2] = '%';
+  fd1 = open("mmapfile", O_RDONLY);
+  if(read(fd1, buf, 10) != 10 || buf[2] != '%'){
+    printf(stdout, "mmap shared write not seen by read\n");
+    exit();
+  }
+  close(fd1);
+  unlink("mmapfile");
+  p[5000] = '&';
+  if(read(fd, buf, sizeof(buf)) != 6000 || buf[2] != '%' || buf[5000] != '&'){
+    printf(stdout, "mmap of unlinked file wrong\n");
+    exit();
+  }
+  munmap(p, 6000);
+  close(fd);
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != 0){
+    printf(stdout, "mmap write back reached a new file\n");
+    exit();
+  }
+  close(fd);
+
+  unlink("mmapfile");
+  printf(stdout, "mmap test ok\n");
+}
+
 // does unintialized data start out zero?
 char uninit[10000];
 void
@@ -1606,6 +2306,29 @@ bsstest(void)
   printf(stdout, "bss test ok\n");
 }
 
+// Does all of the bss start out zero, in particular the part
+// on the last page of initialized data?  That page is only
+// partly backed by the file (filesz < memsz), and the page
+// cache holds whatever follows the data there.  Must run
+// before anything writes to the bss.
+extern char edata[], end[];
+void
+bssedgetest(void)
+{
+  char *p;
+
+  printf(stdout, "bss edge test\n");
+  if((uint)edata % 4096 == 0)
+    printf(stdout, "bss edge test: bss starts on a page boundary\n");
+  for(p = edata; p < end; p++){
+    if(*p != '\0'){
+      printf(stdout, "bss edge test failed at %x\n", p);
+      exit();
+    }
+  }
+  printf(stdout, "bss edge test ok\n");
+}
+
 // does exec return an error if the arguments
 // are larger than a page? or does it write
 // below the stack and wreck the instructions/data?
@@ -1756,6 +2479,7 @@ main(int argc, char *argv[])
   }
   close(open("usertests.ran", O_CREATE));
 
+  bssedgetest();
   argptest();
   createdelete();
   linkunlink();
@@ -1769,6 +2493,7 @@ main(int argc, char *argv[])
   bsstest();
   sbrktest();
   validatetest();
+  mmaptest();
 
   opentest();
   writetest();
@@ -1782,17 +2507,22 @@ main(int argc, char *argv[])
   mem();
   pipe1();
   preempt();
+  priotest();
   exitwait();
 
   rmdot();
   fourteen();
   bigfile();
+  cachetest();
+  iotest();
+  bcachetest();
   subdir();
   linktest();
   unlinkread();
   dirfile();
   iref();
   forktest();
+  cowtest();
   bigdir(); // slow
 
   uio();
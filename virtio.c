@@ -0,0 +1,258 @@
+// Driver for a virtio block device, through the legacy PCI
+// interface.  See Virtual I/O Device (VIRTIO) Version 1.0,
+// sections 2.4 (virtqueues), 4.1.4.8 (legacy PCI registers)
+// and 5.2 (block device).
+//
+// The driver and the device share one virtqueue: a table of
+// descriptors, an available ring on which the driver hands
+// requests to the device, and a used ring on which the device
+// hands them back.  Each request is a chain of descriptors: a
+// header naming the operation and first sector, the data of
+// each of up to VSEG adjacent blocks, and a status byte the
+// device fills in.  Request slot i always uses the VDESC
+// descriptors from i*VDESC, the status byte's last, and up to
+// NVREQ requests are in flight at once: the I/O scheduler
+// starts that many from vq before waiting for any to finish,
+// where IDE takes one at a time.  vq.lock protects the
+// driver's state.
+//
+// If the machine has a virtio block device at boot, it is the
+// file system disk, ROOTDEV, in place of IDE disk 1; the
+// Makefile attaches fs.img that way with "make qemu DISK=virtio".
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "iosched.h"
+
+#define SECTOR_SIZE       512
+
+#define VIRTIO_VENDOR     0x1af4
+#define VIRTIO_DEV_BLK    0x1001  // Transitional block device
+
+// Legacy registers, at offsets from the I/O BAR.
+#define VIO_GUEST_FEAT    0x04    // Features the driver accepts
+#define VIO_QUEUE_PFN     0x08    // Physical page number of the queue
+#define VIO_QUEUE_SIZE    0x0c    // Entries in the queue (read only)
+#define VIO_QUEUE_SEL     0x0e    // Queue the above refer to
+#define VIO_QUEUE_NOTIFY  0x10    // Write a queue number to kick it
+#define VIO_STATUS        0x12
+#define VIO_ISR           0x13    // Reading acknowledges the interrupt
+
+// Device status bits.
+#define VIO_S_ACK         0x01    // Guest has noticed the device
+#define VIO_S_DRIVER      0x02    // Guest has a driver for it
+#define VIO_S_DRIVER_OK   0x04    // Driver is ready
+#define VIO_S_FAILED      0x80    // Driver gave up
+
+#define VQ_ALIGN          4096    // Used ring alignment, legacy
+
+// Descriptor flags.
+#define VRING_NEXT        1       // Chain continues in next
+#define VRING_WRITE       2       // Device writes the buffer
+
+#define VIRTIO_BLK_T_IN   0       // Read
+#define VIRTIO_BLK_T_OUT  1       // Write
+
+#define NVREQ 32
+#define VSEG  8                   // Most blocks in one request
+#define VDESC (VSEG + 2)          // Descriptors per request slot
+
+struct vdesc {
+  uint addr;            // Physical address
+  uint addrhi;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+
+struct vavail {
+  ushort flags;
+  ushort idx;           // Where the driver puts the next entry
+  ushort ring[];        // Heads of descriptor chains
+};
+
+struct vusedelem {
+  uint id;              // Head of the descriptor chain
+  uint len;
+};
+
+struct vused {
+  ushort flags;
+  ushort idx;           // Where the device puts the next entry
+  struct vusedelem ring[];
+};
+
+// A request slot.  The device reads hdr and writes status,
+// so the slots must be in memory with a fixed physical
+// address: the kernel's static data is.
+struct vreq {
+  struct {
+    uint type;
+    uint reserved;
+    uint sector;
+    uint sectorhi;
+  } hdr;
+  uchar status;
+  struct buf *b;        // Buffer being transferred, or 0 if free
+};
+
+static struct ioqueue vq;
+
+static struct {
+  ushort iobase;        // Legacy I/O registers, or 0 if no device
+  uint qsize;           // Entries in the queue
+  int nreq;             // Usable request slots
+  struct vdesc *desc;
+  volatile struct vavail *avail;
+  volatile struct vused *used;
+  ushort usedidx;       // Next used entry to look at
+  struct vreq req[NVREQ];
+} virtio;
+
+int virtioirq = -1;
+
+static void virtiostart(struct buf*);
+
+void
+virtioinit(void)
+{
+  struct pcidev d;
+  struct vreq *r;
+  char *q;
+  uint n, sz;
+  int i, order;
+
+  if(!pcifind(VIRTIO_VENDOR, VIRTIO_DEV_BLK, PCI_ANY, PCI_ANY, &d))
+    return;
+  pcienable(&d);
+
+  outb(d.bar[0] + VIO_STATUS, 0);  // reset
+  outb(d.bar[0] + VIO_STATUS, VIO_S_ACK);
+  outb(d.bar[0] + VIO_STATUS, VIO_S_ACK | VIO_S_DRIVER);
+  outl(d.bar[0] + VIO_GUEST_FEAT, 0);
+
+  // Lay out queue 0 in physically contiguous pages: the
+  // descriptors and available ring, then the used ring on
+  // the next VQ_ALIGN boundary.
+  outw(d.bar[0] + VIO_QUEUE_SEL, 0);
+  n = inw(d.bar[0] + VIO_QUEUE_SIZE);
+  sz = PGROUNDUP(sizeof(struct vdesc)*n + sizeof(ushort)*(3 + n)) +
+       PGROUNDUP(sizeof(ushort)*3 + sizeof(struct vusedelem)*n);
+  for(order = 0; (PGSIZE << order) < sz; order++)
+    ;
+  if(n < VDESC || (q = kallocpages(order)) == 0){
+    outb(d.bar[0] + VIO_STATUS, VIO_S_FAILED);
+    return;
+  }
+  memset(q, 0, PGSIZE << order);
+  virtio.qsize = n;
+  virtio.desc = (struct vdesc*)q;
+  virtio.avail = (struct vavail*)(q + sizeof(struct vdesc)*n);
+  virtio.used = (struct vused*)(q +
+    PGROUNDUP(sizeof(struct vdesc)*n + sizeof(ushort)*(3 + n)));
+  outl(d.bar[0] + VIO_QUEUE_PFN, V2P(q) / VQ_ALIGN);
+
+  // Set up each slot's header and status descriptors once;
+  // only the data descriptors change from request to request.
+  virtio.nreq = n/VDESC < NVREQ ? n/VDESC : NVREQ;
+  for(i = 0; i < virtio.nreq; i++){
+    r = &virtio.req[i];
+    virtio.desc[VDESC*i].addr = V2P(&r->hdr);
+    virtio.desc[VDESC*i].len = sizeof(r->hdr);
+    virtio.desc[VDESC*i].flags = VRING_NEXT;
+    virtio.desc[VDESC*i].next = VDESC*i + 1;
+    virtio.desc[VDESC*i + VDESC-1].addr = V2P(&r->status);
+    virtio.desc[VDESC*i + VDESC-1].len = 1;
+    virtio.desc[VDESC*i + VDESC-1].flags = VRING_WRITE;
+  }
+
+  outb(d.bar[0] + VIO_STATUS, VIO_S_ACK | VIO_S_DRIVER | VIO_S_DRIVER_OK);
+  virtio.iobase = d.bar[0];
+  ioqinit(&vq, "virtio", virtio.nreq, VSEG, virtiostart);
+  ioattach(ROOTDEV, &vq);
+  virtioirq = d.irq;
+  ioapicenable(virtioirq, ncpu - 1);
+  cprintf("virtio: block device at 0x%x irq %d, %d requests\n",
+          virtio.iobase, virtioirq, virtio.nreq);
+}
+
+// Interrupt handler: finish every request the device has
+// put on the used ring, then start more.
+void
+virtiointr(void)
+{
+  struct vreq *r;
+  struct buf *b;
+
+  acquire(&vq.lock);
+  inb(virtio.iobase + VIO_ISR);
+  __sync_synchronize();
+  while(virtio.usedidx != virtio.used->idx){
+    r = &virtio.req[virtio.used->ring[virtio.usedidx % virtio.qsize].id / VDESC];
+    if(r->status != 0)
+      panic("virtio: i/o error");
+    b = r->b;
+    r->b = 0;
+    iodone(&vq, b);
+    virtio.usedidx++;
+  }
+  iostart(&vq);
+  release(&vq.lock);
+}
+
+//PAGEBREAK!
+// Start the request for b and the buffers chained to it
+// through qnext, in a free slot; the I/O scheduler starts no
+// more than there are slots.
+// Caller must hold vq.lock.
+static void
+virtiostart(struct buf *b)
+{
+  struct vreq *r;
+  struct vdesc *d;
+  struct buf *nb;
+  int i, n;
+
+  for(n = 0, nb = b; nb; nb = nb->qnext)
+    n++;
+  if(n > VSEG)
+    panic("virtiostart: request too big");
+  if(b->blockno + n > FSSIZE)
+    panic("virtiostart: incorrect blockno");
+  for(i = 0; i < virtio.nreq; i++)
+    if(virtio.req[i].b == 0)
+      break;
+  if(i == virtio.nreq)
+    panic("virtiostart: no slot");
+
+  r = &virtio.req[i];
+  r->b = b;
+  r->hdr.type = (b->flags & B_DIRTY) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  r->hdr.sector = b->blockno * (BSIZE/SECTOR_SIZE);
+  r->hdr.sectorhi = 0;
+  r->status = 0xff;
+  for(n = 0, nb = b; nb; n++, nb = nb->qnext){
+    d = &virtio.desc[VDESC*i + 1 + n];
+    d->addr = V2P(nb->data);
+    d->len = BSIZE;
+    d->flags = VRING_NEXT | ((b->flags & B_DIRTY) ? 0 : VRING_WRITE);
+    d->next = nb->qnext ? VDESC*i + 2 + n : VDESC*i + VDESC-1;
+  }
+
+  // Publish the chain, then the new index, then tell the device.
+  virtio.avail->ring[virtio.avail->idx % virtio.qsize] = VDESC*i;
+  __sync_synchronize();
+  virtio.avail->idx++;
+  __sync_synchronize();
+  outw(virtio.iobase + VIO_QUEUE_NOTIFY, 0);
+}
@@ -6,9 +6,16 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "fs.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
+static int pse; // CPU supports 4MB pages
+static int pge; // CPU supports global pages
+
+static int lazyalloc(pde_t*, uint, int);
+static int vmafill(pde_t*, struct vma*, uint);
+static int vmaperm(struct vma*);
 
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
@@ -79,6 +86,36 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Like mappages(), but for kernel mappings: where va and pa
+// are both 4MB aligned and at least 4MB remain, map a whole
+// 4MB page with a single directory entry, if the CPU has PSE.
+static int
+mapkpages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
+{
+  char *a;
+  uint n;
+
+  a = va;
+  while(size > 0){
+    if(pse && (uint)a % PDSIZE == 0 && pa % PDSIZE == 0 && size >= PDSIZE){
+      if(pgdir[PDX(a)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(a)] = pa | perm | PTE_P | PTE_PS;
+      n = PDSIZE;
+    } else {
+      n = PDSIZE - (uint)a % PDSIZE;
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, a, n, pa, perm) < 0)
+        return -1;
+    }
+    a += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -92,16 +129,20 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
+//   data..KERNBASE+phystop: mapped to V2P(data)..phystop,
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (phystop, found
+// at boot by kinit1() and at most PHYSLIMIT)
+// (directly addressable from end..P2V(phystop)).
 
 // This table defines the kernel's mappings, which are present in
-// every process's page table.
+// every process's page table.  setupkvm() uses 4MB pages for
+// the parts of them that are suitably aligned.  They are the
+// same in every page table, so they are marked global, and
+// loading %cr3 on a process switch leaves them in the TLB.
 static struct kmap {
   void *virt;
   uint phys_start;
@@ -110,38 +151,59 @@ static struct kmap {
 } kmap[] = {
  { (void*)KERNBASE, 0,             EXTMEM,    PTE_W}, // I/O space
  { (void*)KERNLINK, V2P(KERNLINK), V2P(data), 0},     // kern text+rodata
- { (void*)data,     V2P(data),     PHYSTOP,   PTE_W}, // kern data+memory
+ { (void*)data,     V2P(data),     0,         PTE_W}, // kern data+memory
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+// Set up kernel part of a page table.  The kernel's page
+// tables are built once, in kpgdir, and shared: every page
+// directory gets a copy of kpgdir's kernel-half entries, which
+// point at the same page table pages.  The kernel mappings
+// never change after boot, so the copies stay correct.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
   if((pgdir = (pde_t*)kalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memset(pgdir, 0, PDX(KERNBASE)*sizeof(pde_t));
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES-PDX(KERNBASE))*sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes, and build the kernel page
+// tables that all other page tables share.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+  uint edx;
+
+  rcpuid(1, 0, 0, 0, &edx);
+  pse = (edx & CPUID_PSE) != 0;
+  pge = (edx & CPUID_PGE) != 0;
+  kmap[2].phys_end = phystop;  // kern data+memory
+  if((kpgdir = (pde_t*)kalloc()) == 0)
+    panic("kvmalloc");
+  memset(kpgdir, 0, PGSIZE);
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mapkpages(kpgdir, k->virt, k->phys_end - k->phys_start,
+                (uint)k->phys_start, k->perm | (pge ? PTE_G : 0)) < 0)
+      panic("kvmalloc");
+  kvmenable();
+}
+
+// Switch this CPU to kpgdir and turn on global pages.
+// Run once on each CPU, after kvmalloc().
+void
+kvmenable(void)
+{
   switchkvm();
+  if(pge)
+    lcr4(rcr4() | CR4_PGE);
 }
 
 // Switch h/w page table register to the kernel-only page table,
@@ -279,7 +341,8 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  The kernel part's page tables belong
+// to kpgdir and are shared, so they stay.
 void
 freevm(pde_t *pgdir)
 {
@@ -288,7 +351,7 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -310,38 +373,497 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Map the pages of [start, end) in pgdir into d too.
+// Writable pages become copy-on-write in both, unless the
+// range is shared region v.  Returns 0 on success, -1 if
+// out of memory.
+static int
+copyrange(pde_t *d, pde_t *pgdir, uint start, uint end, struct vma *v)
+{
+  pte_t *pte;
+  uint pa, i, flags;
+  int share;
+
+  share = v && (v->flags & VMA_SHARED);
+  for(i = start; i < end; i += PGSIZE){
+    pte = walkpgdir(pgdir, (void *) i, 0);
+    if(share && (pte == 0 || (*pte & PTE_P) == 0)){
+      // Both sides must end up with the same page.
+      if(v->ip ? vmafill(pgdir, v, i) : lazyalloc(pgdir, i, vmaperm(v)))
+        return -1;
+      pte = walkpgdir(pgdir, (void *) i, 0);
+    }
+    // Pages that were never touched stay lazy in the child too.
+    if(pte == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(!(*pte & PTE_P))
+      continue;
+    if(!share && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    pa = PTE_ADDR(*pte);
+    flags = PTE_FLAGS(*pte);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+      return -1;
+    kref(P2V(pa));
+  }
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  The pages themselves are not copied:
+// both page tables map them read-only and copy-on-write,
+// and pagefault() copies a page when either side first
+// writes it.  Pages of shared mmap() regions stay writable
+// in both, and are filled in first if missing so that both
+// see the same ones.  pgdir must be the current page table.
 pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+copyuvm(pde_t *pgdir, uint sz, struct vma *vma)
 {
   pde_t *d;
-  pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
+  struct vma *v;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0)
+  if(copyrange(d, pgdir, 0, sz, 0) < 0)
+    goto bad;
+  for(v = vma; v < &vma[NVMA]; v++)
+    if((v->flags & VMA_MMAP) && copyrange(d, pgdir, v->start, v->end, v) < 0)
       goto bad;
-  }
+  lcr3(V2P(pgdir));  // parent's PTEs lost PTE_W
   return d;
 
 bad:
+  lcr3(V2P(pgdir));
   freevm(d);
   return 0;
 }
 
+// Allocate a page of user memory.  If memory has run out,
+// take some back from the page and buffer caches first.
+static char*
+ualloc(void)
+{
+  char *mem;
+
+  if((mem = kalloc()) != 0)
+    return mem;
+  if(pcacheshrink(32) > 0 && (mem = kalloc()) != 0)
+    return mem;
+  if(bshrink(4) > 0)
+    mem = kalloc();
+  return mem;
+}
+
+// Give the page at va in pgdir back its write permission,
+// copying it first if another page table still shares it.
+// Returns 0 on success, -1 if va is not a copy-on-write page
+// or there is no memory for the copy.
+static int
+cowcopy(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem, *old;
+
+  va = PGROUNDDOWN(va);
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW))
+    return -1;
+  old = P2V(PTE_ADDR(*pte));
+  if(krefcnt(old) == 1){
+    // Everyone else has copied or exited; take it over.
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+  } else {
+    if((mem = ualloc()) == 0)
+      return -1;
+    memmove(mem, old, PGSIZE);
+    *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+    kfree(old);
+  }
+  invlpg((void*)va);
+  return 0;
+}
+
+// Map a zeroed page at va in pgdir, which has nothing there,
+// with permissions perm.  sbrk() only moves p->sz, so heap
+// pages arrive this way on first touch.
+// Returns 0 on success, -1 if out of memory.
+static int
+lazyalloc(pde_t *pgdir, uint va, int perm)
+{
+  char *mem;
+
+  if((mem = ualloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pgdir, (char*)PGROUNDDOWN(va), PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Return the region of p's address space containing va, or 0.
+static struct vma*
+vmalookup(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Return the page table permissions for region v.
+static int
+vmaperm(struct vma *v)
+{
+  return (v->flags & VMA_WRITE) ? PTE_W|PTE_U : PTE_U;
+}
+
+// Map the page at va, which lies in region v of pgdir,
+// with its contents from v's file.  If the page cache has
+// a page holding exactly those contents, map that page
+// itself: writable for a shared region, copy-on-write for a
+// private one.  Otherwise map a private copy.  May sleep.
+// Returns 0 on success, -1 on failure.
+static int
+vmafill(pde_t *pgdir, struct vma *v, uint va)
+{
+  char *mem;
+  uint off, n;
+  int perm;
+
+  va = PGROUNDDOWN(va);
+  off = va - v->start;
+  n = 0;
+  if(off < v->filesz){
+    n = v->filesz - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+  }
+  perm = vmaperm(v);
+  mem = 0;
+  if(n > 0){
+    ilock(v->ip);
+    if((mem = pcachemap(v->ip, v->off + off, n)) != 0){
+      if(!(v->flags & VMA_SHARED) && (perm & PTE_W))
+        perm = (perm & ~PTE_W) | PTE_COW;
+    } else if((mem = ualloc()) != 0){
+      memset(mem, 0, PGSIZE);
+      if(readi(v->ip, mem, v->off + off, n) != n){
+        kfree(mem);
+        mem = 0;
+      }
+    }
+    iunlock(v->ip);
+  } else if((mem = ualloc()) != 0){
+    memset(mem, 0, PGSIZE);
+  }
+  if(mem == 0)
+    return -1;
+  if(mappages(pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Supply the missing page at va, below p->sz or in one of
+// p's regions: from a file if the region has one, otherwise
+// zeroed.
+static int
+uvmfill(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  if((v = vmalookup(p, va)) == 0)
+    return lazyalloc(p->pgdir, va, PTE_W|PTE_U);
+  if(v->ip == 0)
+    return lazyalloc(p->pgdir, va, vmaperm(v));
+  return vmafill(p->pgdir, v, va);
+}
+
+// Copy the regions in src to dst, taking inode references.
+void
+dupvmas(struct vma *dst, struct vma *src)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    dst[i] = src[i];
+    if(dst[i].ip)
+      idup(dst[i].ip);
+  }
+}
+
+// Release the regions in vma.  Must be called inside
+// a transaction, since it calls iput().
+void
+freevmas(struct vma *vma)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    if(vma[i].ip)
+      iput(vma[i].ip);
+    memset(&vma[i], 0, sizeof(vma[i]));
+  }
+}
+
+// Handle a page fault at user address va in p's page table,
+// which is the current one; err is the error code the
+// processor pushed.  Returns 0 if the faulting access can be
+// retried, -1 if it is a genuine fault.
+int
+pagefault(struct proc *p, uint va, uint err)
+{
+  if(va >= KERNBASE)
+    return -1;
+  if(err & FEC_PR){
+    if(err & FEC_WR)
+      return cowcopy(p->pgdir, va);
+    return -1;
+  }
+  if(va < p->sz || vmalookup(p, va))
+    return uvmfill(p, va);
+  return -1;
+}
+
+// Return 1 if [va, va+n) is all user memory of p, that is
+// below p->sz or in mmap() regions, 0 if not.  An empty
+// range must still start in user memory.
+int
+uvmvalid(struct proc *p, uint va, uint n)
+{
+  struct vma *v;
+  uint end;
+
+  if(n == 0)
+    n = 1;
+  end = va + n;
+  if(end < va || end > KERNBASE)
+    return 0;
+  while(va < end){
+    if(va < p->sz){
+      va = p->sz;
+      continue;
+    }
+    if((v = vmalookup(p, va)) == 0)
+      return 0;
+    va = v->end;
+  }
+  return 1;
+}
+
+// Fault in any pages of [va, va+n) that p has not touched yet,
+// before the kernel uses them.  A kernel access that faults
+// can be served by pagefault(), but it may be holding a
+// spinlock, so it must not sleep reading a file, and if
+// memory has run out there is no way to fail the access;
+// here the caller can fail the system call instead.
+// If write is set, the kernel is about to write the range:
+// fail if a page is read-only, and break copy-on-write
+// sharing now.  Returns 0 on success, -1 on failure.
+// May sleep.  The range must pass uvmvalid().
+int
+uvmtouch(struct proc *p, uint va, uint n, int write)
+{
+  pte_t *pte;
+  uint a, last;
+
+  if(n == 0)
+    return 0;
+  a = PGROUNDDOWN(va);
+  last = PGROUNDDOWN(va + n - 1);
+  for(;; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & PTE_P) == 0){
+      if(uvmfill(p, a) < 0)
+        return -1;
+      pte = walkpgdir(p->pgdir, (char*)a, 0);
+    }
+    if(write && (*pte & PTE_W) == 0 && cowcopy(p->pgdir, a) < 0)
+      return -1;
+    if(a == last)
+      break;
+  }
+  return 0;
+}
+
+// Return 1 if [start, end) overlaps one of p's mmap() regions.
+int
+vmaoverlap(struct proc *p, uint start, uint end)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if((v->flags & VMA_MMAP) && start < v->end && v->start < end)
+      return 1;
+  return 0;
+}
+
+// Add an mmap() region of len bytes to p, at addr if that is
+// page aligned and free, otherwise at the highest free
+// address below KERNBASE and above the heap.  Its contents
+// are filesz bytes of ip from offset off, then zeros; ip may
+// be 0.  Takes a reference to ip.  Pages are filled in by
+// pagefault().  Returns the address, or -1.
+int
+vmamap(struct proc *p, uint addr, uint len, int flags,
+       struct inode *ip, uint off, uint filesz)
+{
+  struct vma *v, *nv;
+  uint a;
+
+  len = PGROUNDUP(len);
+  if(len == 0 || len > KERNBASE)
+    return -1;
+  if(filesz > len)
+    filesz = len;
+  nv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end == 0){
+      nv = v;
+      break;
+    }
+  if(nv == 0)
+    return -1;
+
+  a = addr;
+  if(a % PGSIZE || a < PGROUNDUP(p->sz) || a + len < a || a + len > KERNBASE ||
+     vmaoverlap(p, a, a + len)){
+    a = KERNBASE - len;
+    for(;;){
+      if(a < PGROUNDUP(p->sz))
+        return -1;
+      for(v = p->vma; v < &p->vma[NVMA]; v++)
+        if((v->flags & VMA_MMAP) && a < v->end && v->start < a + len)
+          break;
+      if(v == &p->vma[NVMA])
+        break;
+      if(v->start < len)
+        return -1;
+      a = v->start - len;
+    }
+  }
+
+  nv->start = a;
+  nv->end = a + len;
+  nv->ip = ip ? idup(ip) : 0;
+  nv->off = off;
+  nv->filesz = filesz;
+  nv->flags = flags | VMA_MMAP;
+  return a;
+}
+
+// Write the dirty pages of shared region v in [a, b) back to
+// its file.  The file does not grow: v holds a reference to
+// the inode, so the file cannot have been truncated below
+// v->filesz, even if it was unlinked.  The kernel writes user
+// pages only through their user addresses, so PTE_D is set
+// on every page that has been written.
+static void
+vmawriteback(pde_t *pgdir, struct vma *v, uint a, uint b)
+{
+  // Bytes per transaction, as in filewrite().
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  pte_t *pte;
+  uint va, off, n, i, n1;
+  char *mem;
+
+  for(va = a; va < b; va += PGSIZE){
+    off = va - v->start;
+    if(off >= v->filesz)
+      break;
+    pte = walkpgdir(pgdir, (char*)va, 0);
+    if(pte == 0 || (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+      continue;
+    mem = P2V(PTE_ADDR(*pte));
+    n = v->filesz - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    for(i = 0; i < n; i += n1){
+      n1 = n - i;
+      if(n1 > max)
+        n1 = max;
+      begin_op();
+      ilock(v->ip);
+      writei(v->ip, mem + i, v->off + off + i, n1);
+      iunlock(v->ip);
+      end_op();
+    }
+  }
+}
+
+// Remove the parts of p's mmap() regions that lie in
+// [a, b), a page aligned.  Pages of shared file regions go
+// back to the file first.  Must not be called inside a
+// transaction.  Returns 0 on success, -1 if a region would
+// have to be split and there is no room to record the pieces.
+int
+vmaunmap(struct proc *p, uint a, uint b)
+{
+  struct vma *v, *nv;
+  struct inode *ip;
+  uint s, e;
+
+  b = PGROUNDUP(b);
+  if(a % PGSIZE || b < a)
+    return -1;
+  nv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end == 0)
+      nv = v;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if((v->flags & VMA_MMAP) && a > v->start && b < v->end && nv == 0)
+      return -1;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(!(v->flags & VMA_MMAP) || b <= v->start || a >= v->end)
+      continue;
+    s = a > v->start ? a : v->start;
+    e = b < v->end ? b : v->end;
+    if(v->ip && (v->flags & (VMA_SHARED|VMA_WRITE)) == (VMA_SHARED|VMA_WRITE))
+      vmawriteback(p->pgdir, v, s, e);
+    deallocuvm(p->pgdir, e, s);
+
+    if(s == v->start && e == v->end){
+      ip = v->ip;
+      memset(v, 0, sizeof(*v));
+      if(ip){
+        begin_op();
+        iput(ip);
+        end_op();
+      }
+    } else if(s == v->start){
+      v->off += e - v->start;
+      v->filesz = v->filesz > e - v->start ? v->filesz - (e - v->start) : 0;
+      v->start = e;
+    } else if(e == v->end){
+      if(v->filesz > s - v->start)
+        v->filesz = s - v->start;
+      v->end = s;
+    } else {
+      // Punch a hole: nv gets the part above it.
+      *nv = *v;
+      nv->start = e;
+      nv->off += e - v->start;
+      nv->filesz = v->filesz > e - v->start ? v->filesz - (e - v->start) : 0;
+      if(nv->ip)
+        idup(nv->ip);
+      if(v->filesz > s - v->start)
+        v->filesz = s - v->start;
+      v->end = s;
+    }
+  }
+  lcr3(V2P(p->pgdir));
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -359,16 +881,25 @@ uva2ka(pde_t *pgdir, char *uva)
 
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
-// uva2ka ensures this only works for PTE_U pages.
+// uva2ka ensures this only works for PTE_U pages, and fails
+// on a page that is not mapped.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    // Writing through the kernel mapping would not fault,
+    // so break any copy-on-write sharing first.
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte == 0 || (*pte & PTE_P) == 0)
+      return -1;
+    if((*pte & PTE_COW) && cowcopy(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;